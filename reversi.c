@@ -6,235 +6,3223 @@
 #include <linux/miscdevice.h>
 #include <linux/device.h>
 #include <linux/rwsem.h>
+#include <linux/slab.h>
+#include <linux/xarray.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/kref.h>
+#include <linux/atomic.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/sched.h>
+#include <linux/topology.h>
+#include <linux/bitops.h>
+#include <linux/hash.h>
+#include <linux/swab.h>
+#include <linux/random.h>
+#include <linux/prandom.h>
+#include <linux/sched/signal.h>
+#include <linux/capability.h>
+#if defined(CONFIG_X86_64) && !defined(CONFIG_UML)
+#include <linux/jump_label.h>
+#include <asm/fpu/api.h>
+#include <asm/cpufeature.h>
+#endif
 
 MODULE_LICENSE("GPL");
 
+/*One game. Every open of the device gets its own session. A session with a
+  game in progress stays in the sessions table after its file is closed so it
+  can be picked back up with the 05 command, or saved and restored across a
+  module reload through the control device. The table and the attached file
+  each hold a reference, and mutex guards everything below it.*/
+#define MAX_LOGGED_MOVES 128
+#define MOVE_PASS 0xff
+#define BOARD_MAX 10 /*Boards are 6x6, 8x8 or 10x10, picked by the 00 command*/
+
+/*A bitboard wide enough for any size, 10x10 needs 100 bits*/
+typedef unsigned __int128 bb128;
+
+struct reversi_session {
+    u32 id;
+    int node;     /*NUMA node it was allocated on, its searches run there*/
+    int attached; /*1 while a file is using this session, under its table's lock*/
+    struct kref ref;
+    struct mutex mutex;
+    char kern_buf [120];
+    int out_len; /*Length of the reply in kern_buf*/
+    int size;
+    char gameboard[BOARD_MAX][BOARD_MAX]; /*size x size in the top left*/
+    char turn;
+    char player;
+    char bot;
+    int game_flag;
+    int game_print_end;
+    int self_play; /*Games played by the 06 command, flagged in their records*/
+
+    /*Moves so far, for the game record sent out when the game ends*/
+    u64 last_move_ns;
+    int nmoves;
+    int moves_partial; /*1 if the log is missing moves*/
+    u8 moves[MAX_LOGGED_MOVES]; /*row * size + col, or MOVE_PASS*/
+    u32 move_usecs[MAX_LOGGED_MOVES]; /*Time since the move before*/
+
+    /*Bot search time used in the current quota period, and the quota set
+      by 07, bot_quota_us until quota_set*/
+    u64 period_start;
+    u64 period_used_ns;
+    u32 quota_us;
+    int quota_set;
+
+    struct reversi_watch *watch; /*NULL until the first spectator attaches*/
+};
+
+/*What an open of the device points at. lock serializes commands on the file,
+  session can change with the 05 command. Replies wait in replies until they
+  are read, so one write can carry a batch of commands and one read can take
+  all of their replies. The queue belongs to the file rather than the game,
+  so replies written before a 05 are still read after it.*/
+struct reversi_file {
+    struct mutex lock;
+    struct reversi_session *session;
+    char *replies;
+    size_t reply_head; /*Next byte to read*/
+    size_t reply_tail; /*End of the queued replies*/
+    size_t reply_size; /*Bytes allocated*/
+    u32 id;            /*For the trace*/
+    u32 trace_seq;
+    int busy;          /*1 while a 06 runs without lock, other writes wait*/
+    unsigned int reads; /*Bumped by each read, for writers waiting on room*/
+    wait_queue_head_t read_wait;
+    unsigned int reply_kb; /*reply_queue_kb when the file was opened*/
+    struct record_ring __percpu *trace; /*Where its traffic goes, or NULL*/
+};
+
+/*A bot move waiting for a search worker. It lives on the stack of the
+  writer, which sleeps on done until a worker has filled in row and col.*/
+struct search_job {
+    struct rb_node node;
+    struct completion done;
+    struct reversi_session *s;
+    u64 deadline;        /*Position in the run queue*/
+    u64 search_deadline; /*When the search has to stop*/
+    u64 run_ns;
+    int row;
+    int col;
+    int depth;           /*Deepest search completed*/
+    u64 nodes;
+    int best_sq;         /*Best move after depth, for the next slice*/
+    int yielded;         /*1 if the search stopped to let another job run*/
+    struct search_node *worker; /*Queue of the worker running it*/
+    struct endgame_cache *endgame; /*Cache to look up and store in, or NULL*/
+    unsigned int fixed_depth; /*bot_depth when the job was made*/
+    int book;                 /*bot_book when the job was made*/
+};
+
+/*Search workers. busy is set while the worker is queued or running, so a
+  new job only has to kick an idle one.*/
+struct search_worker {
+    struct work_struct work;
+    int busy;
+    int node;
+};
+
+/*The search queue and workers of one NUMA node. A node without workers
+  sends its searches to home, the next node that has some.*/
+struct search_node {
+    spinlock_t lock;
+    struct rb_root_cached queue;
+    unsigned int queued; /*Jobs in queue, written under lock for search_steal*/
+    struct search_worker *pool;
+    unsigned int pool_size;
+    int home;
+};
+
+/*The sessions opened on one NUMA node, indexed by id / nr_node_ids. lock
+  also covers the attached flag of each session in it.*/
+struct session_table {
+    struct xarray sessions;
+    struct rw_semaphore lock;
+};
+
+/*Save file written by reading the control device and loaded by writing it
+  back. It is a header followed by one record per session, little endian.*/
+#define REVERSI_SNAP_MAGIC   0x53565652 /*"RVVS"*/
+#define REVERSI_SNAP_VERSION 2
+
+struct reversi_snap_header {
+    __le32 magic;
+    __le16 version;
+    __le16 record_size;
+} __packed;
+
+struct reversi_snap_record {
+    __le32 id;
+    u8 turn;
+    u8 player;
+    u8 bot;
+    u8 flags;      /*bit 0 is game_flag, bit 1 is game_print_end*/
+    __le64 x_mask; /*bit row * size + col is set for every X*/
+    __le64 o_mask; /*same for every O*/
+
+    /*Added in version 2, a version 1 record ends here and is an 8x8 board*/
+    __le64 x_mask_high; /*bits 64 and up of x_mask*/
+    __le64 o_mask_high;
+    u8 size;
+} __packed;
+
+#define SNAP_V1_RECORD_SIZE offsetof(struct reversi_snap_record, x_mask_high)
+
+#define SNAP_GAME_FLAG       0x1
+#define SNAP_GAME_PRINT_END  0x2
+
+/*State of one open of the control device. Reads stream the save file out and
+  writes load one in, a partial header or record is held until it completes.*/
+struct reversi_ctl {
+    int next_node;            /*Table being saved*/
+    unsigned long next_index; /*Next index in it*/
+    int header_sent;
+    u8 out[sizeof(struct reversi_snap_record)];
+    size_t out_len;
+    size_t out_off;
+    int header_seen;
+    size_t in_size; /*Record size of the file being loaded*/
+    u8 in[sizeof(struct reversi_snap_record)];
+    size_t in_len;
+    unsigned int skipped; /*Records whose id was already in use*/
+};
+
+/*Every finished game is sent out of the records device as one of these,
+  followed by nmoves move entries. All fields are little endian.*/
+#define REVERSI_RECORD_VERSION 2
+
+struct reversi_game_record {
+    __le16 size;    /*Bytes in the record, moves included*/
+    u8 version;
+    u8 result;      /*'W', 'L' or 'T' for the player*/
+    __le32 session_id;
+    __le64 end_ns;  /*CLOCK_REALTIME when the game ended*/
+    u8 player;
+    u8 x_count;
+    u8 o_count;
+    u8 flags;       /*RECORD_PARTIAL if moves are missing*/
+    __le16 nmoves;
+    u8 board_size;  /*Added in version 2, before that always 8*/
+} __packed;
+
+struct reversi_record_move {
+    u8 square;      /*row * board_size + col, or MOVE_PASS*/
+    __le32 usecs;   /*Time since the move before*/
+} __packed;
+
+#define RECORD_PARTIAL   0x1
+#define RECORD_SELF_PLAY 0x2 /*Bot against bot, from the 06 command*/
+#define RECORD_MAX_SIZE (sizeof(struct reversi_game_record) + \
+                         MAX_LOGGED_MOVES * sizeof(struct reversi_record_move))
+
+/*Spectators read these from the watch device, one per change to the game
+  they are watching. All fields are little endian. A WATCH_BOARD change is
+  sent as two deltas with the same seq, piece 'X' then piece 'O', each mask
+  holding every square with that piece. Together they replace the board.*/
+#define WATCH_MOVE  1 /*mask is the pieces flipped by playing square*/
+#define WATCH_PASS  2
+#define WATCH_BOARD 3 /*On attaching, a new game, or falling too far behind*/
+
+struct reversi_watch_delta {
+    __le32 seq;     /*Session's sequence number once this change is made*/
+    u8 kind;
+    u8 piece;       /*Side that moved*/
+    u8 square;      /*row * size + col, MOVE_PASS if there is none*/
+    u8 size;
+    __le64 mask;    /*bit row * size + col*/
+    __le64 mask_high;
+} __packed;
+
+/*One change in a session's watch ring*/
+struct watch_change {
+    bb128 mask;
+    bb128 o_mask; /*The O pieces of a WATCH_BOARD, mask has the X ones*/
+    u8 kind;
+    u8 piece;
+    u8 square;
+    u8 size;
+};
+
+/*The last WATCH_RING changes to a session, so a move costs its player the
+  same however many spectators there are. The player writes a change under
+  the session's mutex and lock, and spectators copy changes out under lock's
+  sequence count without ever blocking the player. Waking them up is left
+  to the wake work item. A spectator more than WATCH_RING changes behind is
+  sent the whole board instead.*/
+#define WATCH_RING 64
+
+struct reversi_watch {
+    seqlock_t lock;
+    u32 seq;      /*Changes so far, change n is in ring[n % WATCH_RING]*/
+    int watchers; /*Under the session's mutex*/
+    int size;     /*The board after the last change, for new spectators*/
+    bb128 x_mask; /*and to find flips*/
+    bb128 o_mask;
+    wait_queue_head_t wait;
+    struct work_struct wake;
+    struct watch_change ring[WATCH_RING];
+};
+
+/*What an open of the watch device points at. Writing a session id attaches
+  it, after that it is only read.*/
+struct reversi_spectator {
+    struct mutex lock;
+    struct reversi_session *session; /*Holds a reference*/
+    u32 next;       /*seq of the next change to read*/
+    int need_board; /*1 to send the whole board before any more changes*/
+};
+
+/*With trace_ring_kb set, every command a file runs and every reply it gets
+  is sent out of the trace device as one of these, followed by len bytes of
+  the command or reply. All fields are little endian. The events come out
+  grouped by CPU, seq puts a file's events back in order and shows any lost
+  to a full ring.*/
+#define TRACE_COMMAND 1
+#define TRACE_REPLY   2
+
+struct reversi_trace_event {
+    __le16 size;       /*Bytes in the event, data included*/
+    u8 kind;
+    u8 pad;
+    __le32 file;       /*Numbers each open of /dev/reversi*/
+    __le32 seq;        /*Event count for the file*/
+    __le32 session_id;
+    __le64 ns;         /*ktime_get_ns(), the same clock on every CPU*/
+} __packed;
+
+/*Commands longer than this are cut short in the trace, they can only be
+  INVFMT anyway and stay too long to be anything else*/
+#define TRACE_MAX_DATA 128
+
+/*Records are written to a ring on the CPU that finished the game. Only that
+  CPU moves head and only the reader moves tail, so writers never take a lock
+  and a full ring drops the record instead of waiting.*/
+struct record_ring {
+    u8 *buf;
+    unsigned long size; /*Bytes in buf, a power of two*/
+    unsigned long head;
+    unsigned long tail;
+    unsigned long dropped;
+};
+
 /*Necessary kernel module functions*/
 static int reversi_open(struct inode *inodep, struct file *filep);
 static int reversi_release(struct inode *inodep, struct file *filep);
 static ssize_t reversi_read(struct file *filep, char __user *ubuf,
                             size_t count, loff_t *ppos);
 
-static ssize_t reversi_write(struct file *filep, const char __user *ubuf, 
-                             size_t count, loff_t *ppos);
+static ssize_t reversi_write(struct file *filep, const char __user *ubuf, 
+                             size_t count, loff_t *ppos);
+
+/*Control device functions, used to save and restore every session*/
+static int reversi_ctl_open(struct inode *inodep, struct file *filep);
+static int reversi_ctl_release(struct inode *inodep, struct file *filep);
+static ssize_t reversi_ctl_read(struct file *filep, char __user *ubuf,
+                                size_t count, loff_t *ppos);
+static ssize_t reversi_ctl_write(struct file *filep, const char __user *ubuf,
+                                 size_t count, loff_t *ppos);
+
+/*Records device functions, used to stream finished games*/
+static ssize_t records_read(struct file *filep, char __user *ubuf,
+                            size_t count, loff_t *ppos);
+static __poll_t records_poll(struct file *filep, poll_table *wait);
+
+/*Trace device functions, used to capture traffic for reversi_replay*/
+static ssize_t trace_read(struct file *filep, char __user *ubuf,
+                          size_t count, loff_t *ppos);
+static __poll_t trace_poll(struct file *filep, poll_table *wait);
+
+/*Watch device functions, used by spectators*/
+static int watch_open(struct inode *inodep, struct file *filep);
+static int watch_release(struct inode *inodep, struct file *filep);
+static ssize_t watch_read(struct file *filep, char __user *ubuf,
+                          size_t count, loff_t *ppos);
+static ssize_t watch_write(struct file *filep, const char __user *ubuf,
+                           size_t count, loff_t *ppos);
+static __poll_t watch_poll(struct file *filep, poll_table *wait);
+
+/*This function branches off of check_adj_cells, it flips the pieces if a 
+  valid move is found. empty_row and empty_col are the potential spot a piece
+  can be placed. opp_row and opp_col are the spot where an opponent's piece
+  was found, meaning I know what direction to look. Validate is used for checking 
+  if there are any valid moves, used when a player/bot has to pass their turn.*/
+int check_and_flip(struct reversi_session *s, int empty_row, int empty_col,
+                   int opp_row, int opp_col, char piece, int validate);
+
+/*This function checks all 8 surrounding cells. If any of them is an opponent's
+  piece, call check_and_flip. Again, validate is used for checking if a turn
+  can be passed. */
+int check_adj_cells(struct reversi_session *s, int row, int col, char piece,
+                    int validate);
+
+/*Prints output to userspace*/
+void output(struct reversi_session *s, char* string, int length); 
+
+/*Checks if there are any valid moves for the current player*/
+int check_for_valid_moves(struct reversi_session *s, char piece);
+
+/*Checks if the game has ended*/
+int check_game_end(struct reversi_session *s);
+
+/*Counts the pieces and determines a winner if the game has ended*/
+int count_pieces(struct reversi_session *s);
+
+/*Main function to run the game*/
+int start(struct reversi_file *rf, int length);
+
+/*Sets up the starting position of a new game*/
+static void new_game(struct reversi_session *s, char player, int size);
+
+/*Logs a move just made and ends the game if nobody can move. Returns 1 if
+  the game is over.*/
+static int finish_move(struct reversi_session *s, int square);
+
+/*Plays the bot's move for the side to move, returns 0 if it has none*/
+static int play_bot_move(struct reversi_session *s, u32 budget_us,
+                         struct search_job *job);
+
+/*Runs every command in a batch written to the device*/
+static ssize_t run_commands(struct reversi_file *rf, const char *buf,
+                            size_t len, int more);
+
+/*Adds a move to the session's log*/
+static void log_move(struct reversi_session *s, int square);
+
+/*Sends a move, or a pass for MOVE_PASS, to the session's spectators.
+  Called with the session's mutex held after the move is on the board.*/
+static void watch_move(struct reversi_session *s, int square);
+
+/*Sends the whole board to the session's spectators, same locking*/
+static void watch_board(struct reversi_session *s);
+
+/*Sends the record of a finished game to the records device*/
+static void emit_game_record(struct reversi_session *s, int X, int O);
+
+/*Detaches a session from its file, dropping it from the sessions table
+  unless a game is in progress. Called with the session's mutex held.*/
+static void detach_session(struct reversi_session *s);
+
+/*Drops a reference to a session*/
+static void session_put(struct reversi_session *s);
+
+/*Runs the bot's search for a session on a search worker and waits for it.
+  The search stops budget_us after the call. Fills in job with the chosen
+  move, row and col being -1 if there is none.*/
+static void run_bot_search(struct reversi_session *s, u32 budget_us,
+                           struct search_job *job);
+
+/*Splits a session's board into one mask per piece*/
+static void pack_board(struct reversi_session *s, bb128 *x_mask, bb128 *o_mask);
+
+/*Fills the square weights for every board size, done once at load*/
+static void build_weights(void);
+
+/*Fills the opening book, done once at load*/
+static void build_book(void);
+
+/*Finds the book move for P to play on an 8x8 board*/
+static int book_lookup(u64 P, u64 O);
+
+/*Allocates an endgame cache with kb KiB of entries, NULL if out of memory.
+  The shared one is made once at load.*/
+static struct endgame_cache *alloc_endgame_cache(unsigned int kb);
+
+static void free_endgame_cache(struct endgame_cache *cache);
+
+/*Finds the move stored in cache for P to play on an 8x8 board, -1 if there
+  is none*/
+static int endgame_lookup(struct endgame_cache *cache, u64 P, u64 O);
+
+/*Stores the exact result of P to play, its score and best move*/
+static void endgame_store(struct endgame_cache *cache, u64 P, u64 O,
+                          int score, int sq);
+
+/*Reads the number starting at kern_buf[off] up to the newline ending the
+  command, as in "03 5000\n" with off 3*/
+static int parse_arg(struct reversi_session *s, int off, int length, u32 *value);
+
+/*Same for up to max numbers split by spaces, returns how many were read*/
+static int parse_args(struct reversi_session *s, int off, int length,
+                      u32 *values, int max);
+
+/*1 for a board size sessions can play on*/
+static int board_size_ok(u32 size);
+
+/*Every session, in one table per NUMA node so games on one socket do not
+  share locks or cache lines with the other's. Table n holds the ids equal
+  to n modulo nr_node_ids, and a session opened on node n gets one of them.*/
+static struct session_table **session_tables;
+
+/*Table holding the session with this id*/
+static inline struct session_table *session_table(u32 id){
+    return session_tables[id % nr_node_ids];
+}
+
+static unsigned int max_sessions = 1 << 24;
+module_param(max_sessions, uint, 0644);
+MODULE_PARM_DESC(max_sessions, "Largest session id handed out, which caps the open sessions");
+
+static DEFINE_PER_CPU(struct record_ring, record_rings);
+static DECLARE_WAIT_QUEUE_HEAD(records_wait);
+static DEFINE_MUTEX(records_mutex); /*One reader at a time*/
+
+static unsigned int record_ring_kb = 64;
+module_param(record_ring_kb, uint, 0444);
+MODULE_PARM_DESC(record_ring_kb, "Size of each CPU's game record ring in KiB");
+
+static DEFINE_PER_CPU(struct record_ring, trace_rings);
+static DECLARE_WAIT_QUEUE_HEAD(trace_wait);
+static DEFINE_MUTEX(trace_mutex);
+
+static unsigned int trace_ring_kb;
+module_param(trace_ring_kb, uint, 0444);
+MODULE_PARM_DESC(trace_ring_kb, "Size of each CPU's command trace ring in KiB, 0 to not trace");
+
+static atomic_t next_file_id = ATOMIC_INIT(0);
+
+/*Bot searches wait in their session's node's queue ordered by deadline and
+  are run by a fixed pool of workers on that node, so a few long searches
+  cannot hold up every session and a search reads the board from local
+  memory. A search runs a depth at a time, and after each depth it goes
+  back in the queue if a job there is due before it, see search_yield. A
+  worker with nothing left on its node takes jobs from the others, and a
+  job on a node whose workers are all busy wakes an idle worker on another
+  node to take it. A session that has used its quota of search time for
+  the current period has its deadline pushed to the start of the next
+  period.*/
+static struct workqueue_struct *search_wq;
+static struct search_node **search_nodes;
+
+static unsigned int search_workers;
+module_param(search_workers, uint, 0444);
+MODULE_PARM_DESC(search_workers, "Bot search workers, split over the NUMA nodes, 0 for one per CPU");
+
+static unsigned int bot_deadline_us = 1000;
+module_param(bot_deadline_us, uint, 0644);
+MODULE_PARM_DESC(bot_deadline_us, "Time a bot move may wait for a worker");
+
+static unsigned int bot_quota_us = 200000;
+module_param(bot_quota_us, uint, 0644);
+MODULE_PARM_DESC(bot_quota_us, "Bot search time per session per period unless the session sets its own with 07, 0 for no limit");
+
+static unsigned int bot_period_ms = 1000;
+module_param(bot_period_ms, uint, 0644);
+MODULE_PARM_DESC(bot_period_ms, "Length of the bot quota period");
+
+static unsigned int bot_budget_us = 10000;
+module_param(bot_budget_us, uint, 0644);
+MODULE_PARM_DESC(bot_budget_us, "Search time for a 03 with no budget given");
+
+#define BOT_MAX_BUDGET_US 10000000 /*10 seconds*/
+
+static unsigned int reply_queue_kb = 64;
+module_param(reply_queue_kb, uint, 0644);
+MODULE_PARM_DESC(reply_queue_kb, "Unread replies a file may hold in KiB, taken when it is opened");
+
+#define SELF_PLAY_MAX_GAMES 1000000
+
+/*Longest write taken in one call, anything past it is a short write*/
+#define MAX_WRITE (64 * 1024)
+
+static unsigned int bot_depth;
+module_param(bot_depth, uint, 0644);
+MODULE_PARM_DESC(bot_depth, "Search every bot move to this depth whatever the time, for replays that have to match");
+
+static unsigned int bot_simd = 1;
+module_param(bot_simd, uint, 0444);
+MODULE_PARM_DESC(bot_simd, "Generate moves with AVX2 when the CPU has it");
+
+/*On x86-64 the 6x6 and 8x8 boards also get an AVX2 move generator, which
+  runs four directions in each instruction. It is switched on at load if the
+  CPU has AVX2. Vector registers can only be used between kernel_fpu_begin
+  and kernel_fpu_end, which turn preemption and softirqs off, so a search
+  holds the FPU for SEARCH_CHECK_NODES nodes at a time and lets go to
+  reschedule. That is about 100 us at the 9 to 11 million nodes a second the
+  bench measures, where the scalar search can be preempted anywhere. Load
+  with bot_simd=0 to keep that. UML has no kernel_fpu_begin of its own, so
+  it always takes the scalar path.*/
+#if defined(CONFIG_X86_64) && !defined(CONFIG_UML)
+#define BB_SIMD 1
+#define BB_SIMD_TARGET __attribute__((target("avx2")))
+typedef u64 bb_v4 __attribute__((vector_size(32)));
+
+static DEFINE_STATIC_KEY_FALSE(bb_simd_key);
+#endif
+
+static unsigned int bot_book = 1;
+module_param(bot_book, uint, 0644);
+MODULE_PARM_DESC(bot_book, "Play book moves in known openings");
+
+static unsigned int endgame_cache_kb = 4096;
+module_param(endgame_cache_kb, uint, 0444);
+MODULE_PARM_DESC(endgame_cache_kb, "Size of the endgame result cache shared by every session in KiB, 0 for none");
+
+static struct endgame_cache *endgame_cache; /*NULL with endgame_cache_kb=0*/
+
+static unsigned int endgame_empties = 20;
+module_param(endgame_empties, uint, 0644);
+MODULE_PARM_DESC(endgame_empties, "Look bot moves up in the endgame cache with at most this many empty squares");
+
+/*Endgame cache counters, kept per CPU so lookups do not share a line*/
+struct endgame_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+/*Adds up cache's counters over every CPU, all 0 with no cache*/
+static void endgame_stats_sum(struct endgame_cache *cache,
+                              struct endgame_stats *sum);
+
+static const struct file_operations fops = {
+    .owner = THIS_MODULE,
+    .open = reversi_open,
+    .release = reversi_release,
+    .read = reversi_read,
+    .write = reversi_write,
+    .llseek = no_llseek,
+};
+
+static const struct file_operations ctl_fops = {
+    .owner = THIS_MODULE,
+    .open = reversi_ctl_open,
+    .release = reversi_ctl_release,
+    .read = reversi_ctl_read,
+    .write = reversi_ctl_write,
+    .llseek = no_llseek,
+};
+
+static const struct file_operations records_fops = {
+    .owner = THIS_MODULE,
+    .open = nonseekable_open,
+    .read = records_read,
+    .poll = records_poll,
+    .llseek = no_llseek,
+};
+
+static const struct file_operations trace_fops = {
+    .owner = THIS_MODULE,
+    .open = nonseekable_open,
+    .read = trace_read,
+    .poll = trace_poll,
+    .llseek = no_llseek,
+};
+
+static const struct file_operations watch_fops = {
+    .owner = THIS_MODULE,
+    .open = watch_open,
+    .release = watch_release,
+    .read = watch_read,
+    .write = watch_write,
+    .poll = watch_poll,
+    .llseek = no_llseek,
+};
+
+static unsigned long rings_dropped(struct record_ring __percpu *rings){
+    unsigned long dropped;
+    int cpu;
+
+    dropped = 0;
+    for_each_possible_cpu(cpu){
+        dropped += READ_ONCE(per_cpu_ptr(rings, cpu)->dropped);
+    }
+    return dropped;
+}
+
+/*Number of game records lost because a ring was full*/
+static ssize_t dropped_show(struct device *dev, struct device_attribute *attr,
+                            char *buf){
+    return sysfs_emit(buf, "%lu\n", rings_dropped(&record_rings));
+}
+static DEVICE_ATTR_RO(dropped);
+
+static struct attribute *records_attrs[] = {
+    &dev_attr_dropped.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(records);
+
+/*Same for trace events*/
+static ssize_t trace_dropped_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf){
+    return sysfs_emit(buf, "%lu\n", rings_dropped(&trace_rings));
+}
+static struct device_attribute dev_attr_trace_dropped =
+    __ATTR(dropped, 0444, trace_dropped_show, NULL);
+
+static struct attribute *trace_attrs[] = {
+    &dev_attr_trace_dropped.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(trace);
+
+/*Bot moves found in the endgame cache*/
+static ssize_t endgame_hits_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf){
+    struct endgame_stats sum;
+
+    endgame_stats_sum(endgame_cache, &sum);
+    return sysfs_emit(buf, "%lu\n", sum.hits);
+}
+static DEVICE_ATTR_RO(endgame_hits);
+
+/*Bot moves looked up and searched for*/
+static ssize_t endgame_misses_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf){
+    struct endgame_stats sum;
+
+    endgame_stats_sum(endgame_cache, &sum);
+    return sysfs_emit(buf, "%lu\n", sum.misses);
+}
+static DEVICE_ATTR_RO(endgame_misses);
+
+/*Results dropped to make room for new ones*/
+static ssize_t endgame_evictions_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf){
+    struct endgame_stats sum;
+
+    endgame_stats_sum(endgame_cache, &sum);
+    return sysfs_emit(buf, "%lu\n", sum.evictions);
+}
+static DEVICE_ATTR_RO(endgame_evictions);
+
+static struct attribute *ctl_attrs[] = {
+    &dev_attr_endgame_hits.attr,
+    &dev_attr_endgame_misses.attr,
+    &dev_attr_endgame_evictions.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ctl);
+
+static struct miscdevice reversi_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "reversi",
+    .fops = &fops,
+    .mode = 0666, /*Gives correct permissions*/
+};
+
+static struct miscdevice reversi_ctl_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "reversi_ctl",
+    .fops = &ctl_fops,
+    .groups = ctl_groups,
+    .mode = 0600, /*Restoring can replace games, root only*/
+};
+
+static struct miscdevice reversi_records_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "reversi_records",
+    .fops = &records_fops,
+    .groups = records_groups,
+    .mode = 0400, /*Reading consumes records*/
+};
+
+static struct miscdevice reversi_trace_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "reversi_trace",
+    .fops = &trace_fops,
+    .groups = trace_groups,
+    .mode = 0400, /*Holds every player's commands*/
+};
+
+static struct miscdevice reversi_watch_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "reversi_watch",
+    .fops = &watch_fops,
+    .mode = 0666, /*Anyone can watch, as anyone can resume a game with 05*/
+};
+
+static void free_rings(struct record_ring __percpu *rings){
+    struct record_ring *ring;
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        ring = per_cpu_ptr(rings, cpu);
+        kvfree(ring->buf);
+        ring->buf = NULL;
+        ring->size = 0;
+    }
+}
+
+static void search_work(struct work_struct *work);
+
+static void free_search_nodes(void){
+    int node;
+
+    for (node = 0; node < nr_node_ids; node++){
+        if (search_nodes[node] != NULL){
+            kfree(search_nodes[node]->pool);
+            kfree(search_nodes[node]);
+        }
+    }
+    kfree(search_nodes);
+}
+
+/*search_workers is split evenly over the nodes with CPUs, or each of them
+  gets one worker per CPU*/
+static int start_search_workers(void){
+    struct search_node *sn;
+    unsigned int cpu_nodes;
+    unsigned int total;
+    unsigned int size;
+    unsigned int k;
+    unsigned int i;
+    int node;
+
+    search_nodes = kcalloc(nr_node_ids, sizeof(*search_nodes), GFP_KERNEL);
+    if (search_nodes == NULL){
+        return -ENOMEM;
+    }
+
+    cpu_nodes = 0;
+    for (node = 0; node < nr_node_ids; node++){
+        if (nr_cpus_node(node) > 0){
+            cpu_nodes++;
+        }
+    }
+
+    total = 0;
+    k = 0;
+    for (node = 0; node < nr_node_ids; node++){
+        sn = kzalloc_node(sizeof(*sn), GFP_KERNEL,
+                          node_online(node) ? node : NUMA_NO_NODE);
+        if (sn == NULL){
+            goto err;
+        }
+        search_nodes[node] = sn;
+        spin_lock_init(&sn->lock);
+        sn->queue = RB_ROOT_CACHED;
+
+        if (nr_cpus_node(node) == 0){
+            continue;
+        }
+        if (search_workers == 0){
+            size = nr_cpus_node(node);
+        } else {
+            size = search_workers / cpu_nodes + (k < search_workers % cpu_nodes);
+        }
+        k++;
+        if (size == 0){
+            continue;
+        }
+
+        sn->pool = kcalloc_node(size, sizeof(*sn->pool), GFP_KERNEL, node);
+        if (sn->pool == NULL){
+            goto err;
+        }
+        sn->pool_size = size;
+        for (i = 0; i < size; i++){
+            INIT_WORK(&sn->pool[i].work, search_work);
+            sn->pool[i].node = node;
+        }
+        total += size;
+    }
+    if (total == 0){
+        goto err;
+    }
+
+    for (node = 0; node < nr_node_ids; node++){
+        k = node;
+        while (search_nodes[k]->pool_size == 0){
+            k = (k + 1) % nr_node_ids;
+        }
+        search_nodes[node]->home = k;
+    }
+
+    search_wq = alloc_workqueue("reversi_search",
+                                WQ_UNBOUND | WQ_CPU_INTENSIVE, total);
+    if (search_wq == NULL){
+        goto err;
+    }
+    return 0;
+
+err:
+    free_search_nodes();
+    return -ENOMEM;
+}
+
+static void stop_search_workers(void){
+    destroy_workqueue(search_wq);
+    free_search_nodes();
+}
+
+static void free_session_tables(void){
+    int node;
+
+    for (node = 0; node < nr_node_ids; node++){
+        if (session_tables[node] != NULL){
+            xa_destroy(&session_tables[node]->sessions);
+            kfree(session_tables[node]);
+        }
+    }
+    kfree(session_tables);
+}
+
+static int alloc_session_tables(void){
+    struct session_table *t;
+    int node;
+
+    session_tables = kcalloc(nr_node_ids, sizeof(*session_tables), GFP_KERNEL);
+    if (session_tables == NULL){
+        return -ENOMEM;
+    }
+    for (node = 0; node < nr_node_ids; node++){
+        t = kzalloc_node(sizeof(*t), GFP_KERNEL,
+                         node_online(node) ? node : NUMA_NO_NODE);
+        if (t == NULL){
+            free_session_tables();
+            return -ENOMEM;
+        }
+        xa_init_flags(&t->sessions, XA_FLAGS_ALLOC);
+        init_rwsem(&t->lock);
+        session_tables[node] = t;
+    }
+    return 0;
+}
+
+/*Gives each CPU a ring of kb KiB, at least twice the largest entry*/
+static int alloc_rings(struct record_ring __percpu *rings, unsigned int kb,
+                       size_t max_entry){
+    struct record_ring *ring;
+    unsigned long size;
+    int cpu;
+
+    size = roundup_pow_of_two(max_t(unsigned long, kb * 1024UL,
+                                    2 * max_entry));
+
+    for_each_possible_cpu(cpu){
+        ring = per_cpu_ptr(rings, cpu);
+        ring->buf = kvmalloc_node(size, GFP_KERNEL, cpu_to_node(cpu));
+        if (ring->buf == NULL){
+            free_rings(rings);
+            return -ENOMEM;
+        }
+        ring->size = size;
+    }
+    return 0;
+}
+
+/*Initialization function for the device*/
+static int __init reversi_init(void){
+
+    int check;
+    build_weights();
+    build_book();
+
+#ifdef BB_SIMD
+    if (bot_simd && boot_cpu_has(X86_FEATURE_AVX2) &&
+        cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL)){
+        static_branch_enable(&bb_simd_key);
+    }
+#endif
+
+    check = alloc_rings(&record_rings, record_ring_kb, RECORD_MAX_SIZE);
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        return check;
+    }
+
+    if (trace_ring_kb != 0){
+        check = alloc_rings(&trace_rings, trace_ring_kb,
+                            sizeof(struct reversi_trace_event) + TRACE_MAX_DATA);
+        if(check != 0){
+            printk(KERN_ALERT"ERROR!\n");
+            goto err_rings;
+        }
+    }
+
+    if (endgame_cache_kb != 0){
+        endgame_cache = alloc_endgame_cache(endgame_cache_kb);
+        check = endgame_cache == NULL ? -ENOMEM : 0;
+        if(check != 0){
+            printk(KERN_ALERT"ERROR!\n");
+            goto err_trace;
+        }
+    }
+
+    check = alloc_session_tables();
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_endgame;
+    }
+
+    check = start_search_workers();
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_tables;
+    }
+
+    check = misc_register(&reversi_device);
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_search;
+    }
+
+    check = misc_register(&reversi_ctl_device);
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_device;
+    }
+
+    check = misc_register(&reversi_records_device);
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_ctl;
+    }
+
+    check = misc_register(&reversi_trace_device);
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_records;
+    }
+
+    check = misc_register(&reversi_watch_device);
+    if(check != 0){
+        printk(KERN_ALERT"ERROR!\n");
+        goto err_trace_device;
+    }
+
+    return 0;
+
+err_trace_device:
+    misc_deregister(&reversi_trace_device);
+err_records:
+    misc_deregister(&reversi_records_device);
+err_ctl:
+    misc_deregister(&reversi_ctl_device);
+err_device:
+    misc_deregister(&reversi_device);
+err_search:
+    stop_search_workers();
+err_tables:
+    free_session_tables();
+err_endgame:
+    free_endgame_cache(endgame_cache);
+err_trace:
+    free_rings(&trace_rings);
+err_rings:
+    free_rings(&record_rings);
+    return check;
+}
+
+/*Uninitialization function*/
+static void __exit reversi_exit(void){
+    struct reversi_session *s;
+    unsigned long index;
+    int node;
+
+    misc_deregister(&reversi_watch_device);
+    misc_deregister(&reversi_trace_device);
+    misc_deregister(&reversi_records_device);
+    misc_deregister(&reversi_ctl_device);
+    misc_deregister(&reversi_device);
+    stop_search_workers();
+    free_endgame_cache(endgame_cache);
+    free_rings(&trace_rings);
+    free_rings(&record_rings);
+
+    for (node = 0; node < nr_node_ids; node++){
+        xa_for_each(&session_tables[node]->sessions, index, s){
+            session_put(s);
+        }
+    }
+    free_session_tables();
+}
+
+/*A new session in the memory of node*/
+static struct reversi_session *alloc_session(int node){
+    struct reversi_session *s;
+
+    s = kzalloc_node(sizeof(*s), GFP_KERNEL,
+                     node_online(node) ? node : NUMA_NO_NODE);
+    if (s == NULL){
+        return NULL;
+    }
+    kref_init(&s->ref);
+    mutex_init(&s->mutex);
+    s->size = 8;
+    s->node = node;
+    return s;
+}
+
+/*Gives s the lowest free id in its node's table and adds it there*/
+static int session_add(struct reversi_session *s){
+    struct session_table *t;
+    unsigned int max;
+    u32 index;
+    int check;
+
+    max = READ_ONCE(max_sessions);
+    if (max < s->node){
+        return -EBUSY;
+    }
+
+    t = session_tables[s->node];
+    down_write(&t->lock);
+    check = xa_alloc(&t->sessions, &index, s,
+                     XA_LIMIT(s->node == 0 ? 1 : 0,
+                              (max - s->node) / nr_node_ids),
+                     GFP_KERNEL);
+    if (check == 0){
+        s->id = index * nr_node_ids + s->node;
+    }
+    up_write(&t->lock);
+    return check;
+}
+
+static void free_session(struct kref *ref){
+    struct reversi_session *s;
+
+    s = container_of(ref, struct reversi_session, ref);
+    if (s->watch != NULL){
+        cancel_work_sync(&s->watch->wake);
+        kfree(s->watch);
+    }
+    kfree(s);
+}
+
+static void session_put(struct reversi_session *s){
+    kref_put(&s->ref, free_session);
+}
+
+/*Function that runs when the device is opened*/
+static int reversi_open(struct inode *inodep, struct file *filep){
+    struct reversi_session *s;
+    struct reversi_file *rf;
+    int check;
+    int node;
+
+    printk(KERN_ALERT"Reversi device opened\n");
+
+    /*The game stays on the node of the CPU opening it*/
+    node = numa_node_id();
+
+    rf = kzalloc_node(sizeof(*rf), GFP_KERNEL, node);
+    if (rf == NULL){
+        return -ENOMEM;
+    }
+    mutex_init(&rf->lock);
+    init_waitqueue_head(&rf->read_wait);
+    rf->id = atomic_inc_return(&next_file_id);
+    rf->reply_kb = READ_ONCE(reply_queue_kb);
+    if (trace_ring_kb != 0){
+        rf->trace = &trace_rings;
+    }
+
+    s = alloc_session(node);
+    if (s == NULL){
+        kfree(rf);
+        return -ENOMEM;
+    }
+    s->attached = 1;
+    kref_get(&s->ref); /*One for the table, one for the file*/
+
+    check = session_add(s);
+
+    if (check != 0){
+        kfree(s);
+        kfree(rf);
+        return check == -EBUSY ? -ENOSPC : check;
+    }
+
+    rf->session = s;
+    filep->private_data = rf;
+    return 0;
+}
+
+/*Function that runs when device is closed*/
+static int reversi_release(struct inode *inodep, struct file *filep){
+    struct reversi_session *s;
+    struct reversi_file *rf;
+
+    printk(KERN_ALERT"Reversi device released\n");
+
+    rf = filep->private_data;
+    s = rf->session;
+
+    mutex_lock(&s->mutex);
+    detach_session(s);
+    mutex_unlock(&s->mutex);
+
+    session_put(s);
+    kfree(rf->replies);
+    kfree(rf);
+    return 0;
+}
+
+static void detach_session(struct reversi_session *s){
+    struct session_table *t;
+
+    t = session_table(s->id);
+    down_write(&t->lock);
+    s->attached = 0;
+    if (s->game_flag == 0){
+        xa_erase(&t->sessions, s->id / nr_node_ids);
+        session_put(s); /*The table's reference, the caller still has one*/
+    }
+    up_write(&t->lock);
+}
+
+/*Device read function, takes as many queued replies as fit. Returns 0 once
+  every reply has been read.*/
+static ssize_t reversi_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos){
+    struct reversi_file *rf;
+    size_t n;
+
+    rf = filep->private_data;
+    mutex_lock(&rf->lock);
+    n = min(count, rf->reply_tail - rf->reply_head);
+    if (copy_to_user(ubuf, rf->replies + rf->reply_head, n) != 0){
+        mutex_unlock(&rf->lock);
+        return -EFAULT;
+    }
+    rf->reply_head += n;
+    if (n > 0){
+        WRITE_ONCE(rf->reads, rf->reads + 1);
+        wake_up_interruptible(&rf->read_wait);
+    }
+    mutex_unlock(&rf->lock);
+
+    *ppos += n;
+    return n;
+}
+
+/*Device write function. Each line is a command, and a last command with no
+  newline runs too. If the reply queue fills up the write stops short after
+  the last command that ran. When not one command fits it waits for a read,
+  or gets -EAGAIN with O_NONBLOCK. A write while a 06 on the file is still
+  playing gets -EBUSY.*/
+static ssize_t reversi_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos){
+    struct reversi_file *rf;
+    unsigned int reads;
+    ssize_t done;
+    size_t len;
+    char *buf;
+    
+    rf = filep->private_data;
+    if (count == 0){
+        return 0;
+    }
+
+    len = min_t(size_t, count, MAX_WRITE);
+    buf = kvmalloc(len, GFP_KERNEL);
+    if (buf == NULL){
+        return -ENOMEM;
+    }
+    if (copy_from_user(buf, ubuf, len) != 0){
+        kvfree(buf);
+        return -EFAULT;
+    }
+
+    mutex_lock(&rf->lock);
+    while (1){
+        if (rf->busy){
+            done = -EBUSY;
+            break;
+        }
+        done = run_commands(rf, buf, len, len < count);
+        if (done == 0 && len < count){
+            /*Not one newline in MAX_WRITE bytes, that is no command*/
+            done = run_commands(rf, buf, len, 0);
+        }
+        if (done != -EAGAIN || (filep->f_flags & O_NONBLOCK)){
+            break;
+        }
+
+        /*The reply queue is full, wait for a read to make room*/
+        reads = rf->reads;
+        mutex_unlock(&rf->lock);
+        if (wait_event_interruptible(rf->read_wait,
+                                     READ_ONCE(rf->reads) != reads)){
+            kvfree(buf);
+            return -ERESTARTSYS;
+        }
+        mutex_lock(&rf->lock);
+    }
+    mutex_unlock(&rf->lock);
+    kvfree(buf);
+
+    if (done > 0){
+        *ppos += done;
+    }
+    return done;
+}
+
+static int reversi_ctl_open(struct inode *inodep, struct file *filep){
+    struct reversi_ctl *ctl;
+
+    ctl = kzalloc(sizeof(*ctl), GFP_KERNEL);
+    if (ctl == NULL){
+        return -ENOMEM;
+    }
+    filep->private_data = ctl;
+    return 0;
+}
+
+static int reversi_ctl_release(struct inode *inodep, struct file *filep){
+    struct reversi_ctl *ctl;
+
+    ctl = filep->private_data;
+    if (ctl->skipped != 0){
+        printk(KERN_WARNING"reversi: %u saved sessions not restored, their ids were in use\n",
+               ctl->skipped);
+    }
+    kfree(ctl);
+    return 0;
+}
+
+/*Puts the next piece of the save file in ctl->out. Returns 0 once every
+  session has been saved. Sessions are visited a table at a time in id order
+  and each record is taken under the session's mutex, so a save costs the same per session
+  however many reads it is split across.*/
+static int snapshot_next(struct reversi_ctl *ctl){
+    struct reversi_snap_header *hdr;
+    struct reversi_snap_record *rec;
+    struct reversi_session *s;
+    struct session_table *t;
+    unsigned long index;
+    bb128 x_mask;
+    bb128 o_mask;
+
+    if (ctl->header_sent == 0){
+        hdr = (struct reversi_snap_header *)ctl->out;
+        hdr->magic = cpu_to_le32(REVERSI_SNAP_MAGIC);
+        hdr->version = cpu_to_le16(REVERSI_SNAP_VERSION);
+        hdr->record_size = cpu_to_le16(sizeof(*rec));
+        ctl->out_len = sizeof(*hdr);
+        ctl->out_off = 0;
+        ctl->header_sent = 1;
+        return 1;
+    }
+
+    for (;;){
+        if (ctl->next_node >= nr_node_ids){
+            return 0;
+        }
+        t = session_tables[ctl->next_node];
+        index = ctl->next_index;
+
+        down_read(&t->lock);
+        s = xa_find(&t->sessions, &index, ULONG_MAX, XA_PRESENT);
+        if (s == NULL){
+            up_read(&t->lock);
+            ctl->next_node++;
+            ctl->next_index = 0;
+            continue;
+        }
+        kref_get(&s->ref);
+        up_read(&t->lock);
+        ctl->next_index = index + 1;
+
+        /*Only games still in progress, a finished one could never be
+          resumed after a restore and would hold its id until unload*/
+        mutex_lock(&s->mutex);
+        if (s->game_flag == 1){
+            break;
+        }
+        mutex_unlock(&s->mutex);
+        session_put(s);
+    }
+
+    pack_board(s, &x_mask, &o_mask);
+
+    rec = (struct reversi_snap_record *)ctl->out;
+    rec->id = cpu_to_le32(s->id);
+    rec->turn = s->turn;
+    rec->player = s->player;
+    rec->bot = s->bot;
+    rec->flags = 0;
+    if (s->game_flag == 1){
+        rec->flags |= SNAP_GAME_FLAG;
+    }
+    if (s->game_print_end == 1){
+        rec->flags |= SNAP_GAME_PRINT_END;
+    }
+    rec->x_mask = cpu_to_le64((u64)x_mask);
+    rec->o_mask = cpu_to_le64((u64)o_mask);
+    rec->x_mask_high = cpu_to_le64((u64)(x_mask >> 64));
+    rec->o_mask_high = cpu_to_le64((u64)(o_mask >> 64));
+    rec->size = s->size;
+    mutex_unlock(&s->mutex);
+    session_put(s);
+
+    ctl->out_len = sizeof(*rec);
+    ctl->out_off = 0;
+    return 1;
+}
+
+/*Reading the control device saves every session*/
+static ssize_t reversi_ctl_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos){
+    struct reversi_ctl *ctl;
+    size_t done;
+    size_t n;
+
+    ctl = filep->private_data;
+    done = 0;
+
+    while (done < count){
+        if (ctl->out_off == ctl->out_len){
+            if (snapshot_next(ctl) == 0){
+                break;
+            }
+        }
+
+        n = min(count - done, ctl->out_len - ctl->out_off);
+        if (copy_to_user(ubuf + done, ctl->out + ctl->out_off, n) != 0){
+            return done > 0 ? done : -EFAULT;
+        }
+        ctl->out_off += n;
+        done += n;
+    }
+
+    *ppos += done;
+    return done;
+}
+
+/*Adds one saved session back to the table for its id. It is left detached,
+  waiting for a 05 command to resume it. A finished game is dropped, and
+  -EEXIST means the id was taken since the save.*/
+static int restore_session(const struct reversi_snap_record *rec){
+    struct reversi_session *s;
+    struct session_table *t;
+    bb128 x_mask;
+    bb128 o_mask;
+    u32 size;
+    u32 id;
+    int check;
+    int i;
+    int j;
+
+    id = le32_to_cpu(rec->id);
+    x_mask = ((bb128)le64_to_cpu(rec->x_mask_high) << 64) |
+             le64_to_cpu(rec->x_mask);
+    o_mask = ((bb128)le64_to_cpu(rec->o_mask_high) << 64) |
+             le64_to_cpu(rec->o_mask);
+    size = rec->size != 0 ? rec->size : 8; /*Version 1*/
+
+    if (id == 0 || (x_mask & o_mask) != 0 || rec->flags > 3){
+        return -EINVAL;
+    }
+    if (board_size_ok(size) == 0 || ((x_mask | o_mask) >> (size * size)) != 0){
+        return -EINVAL;
+    }
+    if ((rec->player != 'X' && rec->player != 'O') ||
+        (rec->bot != 'X' && rec->bot != 'O') || rec->player == rec->bot){
+        return -EINVAL;
+    }
+    if (rec->turn != 'X' && rec->turn != 'O'){
+        return -EINVAL;
+    }
+    if ((rec->flags & SNAP_GAME_FLAG) == 0){ /*From an older save*/
+        return 0;
+    }
+
+    s = alloc_session(id % nr_node_ids); /*The node of the table it goes in*/
+    if (s == NULL){
+        return -ENOMEM;
+    }
+
+    s->id = id;
+    s->size = size;
+    s->turn = rec->turn;
+    s->player = rec->player;
+    s->bot = rec->bot;
+    s->game_flag = (rec->flags & SNAP_GAME_FLAG) ? 1 : 0;
+    s->game_print_end = (rec->flags & SNAP_GAME_PRINT_END) ? 1 : 0;
+    s->last_move_ns = ktime_get_ns();
+    s->moves_partial = 1; /*Moves before the save are not kept*/
+
+    for (i = 0; i < size; i++){
+        for (j = 0; j < size; j++){
+            if (x_mask & ((bb128)1 << (i * size + j))){
+                s->gameboard[i][j] = 'X';
+            } else if (o_mask & ((bb128)1 << (i * size + j))){
+                s->gameboard[i][j] = 'O';
+            } else {
+                s->gameboard[i][j] = '-';
+            }
+        }
+    }
+
+    t = session_table(id);
+    down_write(&t->lock);
+    check = xa_insert(&t->sessions, id / nr_node_ids, s, GFP_KERNEL);
+    up_write(&t->lock);
+
+    if (check != 0){
+        session_put(s);
+        return check == -EBUSY ? -EEXIST : check;
+    }
+    return 0;
+}
+
+/*Writing a save file to the control device restores every session in it*/
+static ssize_t reversi_ctl_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos){
+    struct reversi_snap_header *hdr;
+    struct reversi_ctl *ctl;
+    size_t want;
+    size_t done;
+    size_t n;
+    int check;
+
+    ctl = filep->private_data;
+    done = 0;
+
+    while (done < count){
+        if (ctl->header_seen == 0){
+            want = sizeof(struct reversi_snap_header);
+        } else {
+            want = ctl->in_size;
+        }
+
+        n = min(count - done, want - ctl->in_len);
+        if (copy_from_user(ctl->in + ctl->in_len, ubuf + done, n) != 0){
+            return done > 0 ? done : -EFAULT;
+        }
+        ctl->in_len += n;
+        done += n;
+
+        if (ctl->in_len < want){
+            break;
+        }
+        ctl->in_len = 0;
+
+        if (ctl->header_seen == 0){
+            hdr = (struct reversi_snap_header *)ctl->in;
+            if (le32_to_cpu(hdr->magic) != REVERSI_SNAP_MAGIC){
+                return -EINVAL;
+            }
+            if (le16_to_cpu(hdr->version) == 1){
+                ctl->in_size = SNAP_V1_RECORD_SIZE;
+            } else if (le16_to_cpu(hdr->version) == REVERSI_SNAP_VERSION){
+                ctl->in_size = sizeof(struct reversi_snap_record);
+            } else {
+                return -EINVAL;
+            }
+            if (le16_to_cpu(hdr->record_size) != ctl->in_size){
+                return -EINVAL;
+            }
+            memset(ctl->in, 0, sizeof(ctl->in));
+            ctl->header_seen = 1;
+        } else {
+            /*A session opened before the load can hold a saved id, which
+              costs that one game rather than the rest of the file*/
+            check = restore_session((struct reversi_snap_record *)ctl->in);
+            if (check == -EEXIST){
+                ctl->skipped++;
+            } else if (check != 0){
+                return check;
+            }
+            /*A shorter, older record leaves the new fields zero*/
+            memset(ctl->in, 0, sizeof(ctl->in));
+        }
+    }
+
+    *ppos += done;
+    return done;
+}
+
+static void log_move(struct reversi_session *s, int square){
+    u64 now;
+
+    now = ktime_get_ns();
+    if (s->nmoves < MAX_LOGGED_MOVES){
+        s->moves[s->nmoves] = square;
+        s->move_usecs[s->nmoves] = min_t(u64, U32_MAX,
+                                         div_u64(now - s->last_move_ns,
+                                                 NSEC_PER_USEC));
+        s->nmoves++;
+    } else {
+        s->moves_partial = 1;
+    }
+    s->last_move_ns = now;
+    watch_move(s, square);
+}
+
+/*Copies len bytes into the ring at pos, wrapping at the end*/
+static void ring_put(struct record_ring *ring, unsigned long pos,
+                     const void *src, size_t len){
+    size_t off;
+    size_t first;
+
+    off = pos & (ring->size - 1);
+    first = min(len, ring->size - off);
+    memcpy(ring->buf + off, src, first);
+    memcpy(ring->buf, (const u8 *)src + first, len - first);
+}
+
+static void emit_game_record(struct reversi_session *s, int X, int O){
+    struct reversi_game_record rec;
+    struct reversi_record_move move;
+    struct record_ring *ring;
+    unsigned long head;
+    unsigned long tail;
+    size_t size;
+    int mine;
+    int theirs;
+    int i;
+
+    mine = s->player == 'X' ? X : O;
+    theirs = s->player == 'X' ? O : X;
+
+    size = sizeof(rec) + s->nmoves * sizeof(move);
+    rec.size = cpu_to_le16(size);
+    rec.version = REVERSI_RECORD_VERSION;
+    rec.result = mine > theirs ? 'W' : (mine < theirs ? 'L' : 'T');
+    rec.session_id = cpu_to_le32(s->id);
+    rec.end_ns = cpu_to_le64(ktime_get_real_ns());
+    rec.player = s->player;
+    rec.x_count = X;
+    rec.o_count = O;
+    rec.flags = s->moves_partial ? RECORD_PARTIAL : 0;
+    if (s->self_play){
+        rec.flags |= RECORD_SELF_PLAY;
+    }
+    rec.nmoves = cpu_to_le16(s->nmoves);
+    rec.board_size = s->size;
+
+    ring = get_cpu_ptr(&record_rings);
+    head = ring->head;
+    tail = smp_load_acquire(&ring->tail);
+    if (ring->size - (head - tail) < size){
+        ring->dropped++;
+        put_cpu_ptr(&record_rings);
+        return;
+    }
+
+    ring_put(ring, head, &rec, sizeof(rec));
+    head += sizeof(rec);
+    for (i = 0; i < s->nmoves; i++){
+        move.square = s->moves[i];
+        move.usecs = cpu_to_le32(s->move_usecs[i]);
+        ring_put(ring, head, &move, sizeof(move));
+        head += sizeof(move);
+    }
+    smp_store_release(&ring->head, head);
+    put_cpu_ptr(&record_rings);
+
+    if (wq_has_sleeper(&records_wait)){
+        wake_up_interruptible(&records_wait);
+    }
+}
+
+static int rings_available(struct record_ring __percpu *rings){
+    struct record_ring *ring;
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        ring = per_cpu_ptr(rings, cpu);
+        if (READ_ONCE(ring->head) != READ_ONCE(ring->tail)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*Copies whole entries out of every CPU's ring in a set. Each entry starts
+  with its size as a __le16. Blocks until there is at least one unless the
+  file is non-blocking, mutex keeps to one reader at a time.*/
+static ssize_t rings_read(struct record_ring __percpu *rings,
+                          wait_queue_head_t *wait, struct mutex *mutex,
+                          struct file *filep, char __user *ubuf, size_t count){
+    struct record_ring *ring;
+    unsigned long head;
+    unsigned long tail;
+    __le16 size_le;
+    size_t size;
+    size_t off;
+    size_t first;
+    size_t done;
+    int cpu;
+
+    if (mutex_lock_interruptible(mutex) != 0){
+        return -ERESTARTSYS;
+    }
+
+    while (rings_available(rings) == 0){
+        mutex_unlock(mutex);
+        if (filep->f_flags & O_NONBLOCK){
+            return -EAGAIN;
+        }
+        if (wait_event_interruptible(*wait, rings_available(rings))){
+            return -ERESTARTSYS;
+        }
+        if (mutex_lock_interruptible(mutex) != 0){
+            return -ERESTARTSYS;
+        }
+    }
+
+    done = 0;
+    for_each_possible_cpu(cpu){
+        ring = per_cpu_ptr(rings, cpu);
+        head = smp_load_acquire(&ring->head);
+        tail = ring->tail;
+
+        while (tail != head){
+            off = tail & (ring->size - 1);
+            first = min(sizeof(size_le), ring->size - off);
+            memcpy(&size_le, ring->buf + off, first);
+            memcpy((u8 *)&size_le + first, ring->buf, sizeof(size_le) - first);
+            size = le16_to_cpu(size_le);
+
+            if (size > count - done){
+                goto out;
+            }
+
+            first = min(size, ring->size - off);
+            if (copy_to_user(ubuf + done, ring->buf + off, first) != 0 ||
+                copy_to_user(ubuf + done + first, ring->buf, size - first) != 0){
+                mutex_unlock(mutex);
+                return done > 0 ? done : -EFAULT;
+            }
+            done += size;
+            tail += size;
+            smp_store_release(&ring->tail, tail);
+        }
+    }
+
+out:
+    mutex_unlock(mutex);
+
+    /*The buffer cannot hold even the next entry*/
+    if (done == 0){
+        return -EINVAL;
+    }
+    return done;
+}
+
+static ssize_t records_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos){
+    return rings_read(&record_rings, &records_wait, &records_mutex, filep,
+                      ubuf, count);
+}
+
+static __poll_t records_poll(struct file *filep, poll_table *wait){
+    poll_wait(filep, &records_wait, wait);
+    if (rings_available(&record_rings)){
+        return EPOLLIN | EPOLLRDNORM;
+    }
+    return 0;
+}
+
+/*Sends a command or reply of a file to the trace rings. Called with the
+  file's lock held, and costs one branch when tracing is off.*/
+static void trace_event(struct reversi_file *rf, int kind, const char *data,
+                        size_t len){
+    struct reversi_trace_event ev;
+    struct record_ring *ring;
+    unsigned long head;
+    unsigned long tail;
+    size_t size;
+
+    if (rf->trace == NULL){
+        return;
+    }
+
+    len = min_t(size_t, len, TRACE_MAX_DATA);
+    size = sizeof(ev) + len;
+    ev.size = cpu_to_le16(size);
+    ev.kind = kind;
+    ev.pad = 0;
+    ev.file = cpu_to_le32(rf->id);
+    ev.seq = cpu_to_le32(rf->trace_seq++);
+    ev.session_id = cpu_to_le32(rf->session->id);
+    ev.ns = cpu_to_le64(ktime_get_ns());
+
+    ring = get_cpu_ptr(rf->trace);
+    head = ring->head;
+    tail = smp_load_acquire(&ring->tail);
+    if (ring->size - (head - tail) < size){
+        ring->dropped++;
+        put_cpu_ptr(rf->trace);
+        return;
+    }
+    ring_put(ring, head, &ev, sizeof(ev));
+    ring_put(ring, head + sizeof(ev), data, len);
+    smp_store_release(&ring->head, head + size);
+    put_cpu_ptr(rf->trace);
+
+    if (wq_has_sleeper(&trace_wait)){
+        wake_up_interruptible(&trace_wait);
+    }
+}
+
+static ssize_t trace_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos){
+    return rings_read(&trace_rings, &trace_wait, &trace_mutex, filep,
+                      ubuf, count);
+}
+
+static __poll_t trace_poll(struct file *filep, poll_table *wait){
+    poll_wait(filep, &trace_wait, wait);
+    if (rings_available(&trace_rings)){
+        return EPOLLIN | EPOLLRDNORM;
+    }
+    return 0;
+}
+
+static void watch_wake(struct work_struct *work){
+    struct reversi_watch *w;
+
+    w = container_of(work, struct reversi_watch, wake);
+    wake_up_interruptible_poll(&w->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+/*Adds a change to the ring along with the board after it, O(1) for the
+  player whatever the number of spectators*/
+static void watch_push(struct reversi_session *s, const struct watch_change *c,
+                       bb128 x_mask, bb128 o_mask){
+    struct reversi_watch *w;
+
+    w = s->watch;
+    write_seqlock(&w->lock);
+    w->size = c->size;
+    w->x_mask = x_mask;
+    w->o_mask = o_mask;
+    w->ring[(w->seq + 1) % WATCH_RING] = *c;
+    WRITE_ONCE(w->seq, w->seq + 1);
+    write_sequnlock(&w->lock);
+
+    if (w->watchers > 0){
+        queue_work(system_wq, &w->wake);
+    }
+}
+
+static void watch_move(struct reversi_session *s, int square){
+    struct watch_change c;
+    struct reversi_watch *w;
+    bb128 x_mask;
+    bb128 o_mask;
+
+    w = s->watch;
+    if (w == NULL){
+        return;
+    }
+
+    c.kind = square == MOVE_PASS ? WATCH_PASS : WATCH_MOVE;
+    c.piece = s->turn;
+    c.square = square;
+    c.size = s->size;
+    c.mask = 0;
+    c.o_mask = 0;
+    x_mask = w->x_mask;
+    o_mask = w->o_mask;
+
+    if (square != MOVE_PASS){
+        pack_board(s, &x_mask, &o_mask);
+        if (s->turn == 'X'){
+            c.mask = w->o_mask & ~o_mask;
+        } else {
+            c.mask = w->x_mask & ~x_mask;
+        }
+    }
+    watch_push(s, &c, x_mask, o_mask);
+}
+
+static void watch_board(struct reversi_session *s){
+    struct watch_change c;
+    struct reversi_watch *w;
+
+    w = s->watch;
+    if (w == NULL){
+        return;
+    }
+
+    pack_board(s, &c.mask, &c.o_mask);
+    c.kind = WATCH_BOARD;
+    c.piece = 'X';
+    c.square = MOVE_PASS;
+    c.size = s->size;
+    watch_push(s, &c, c.mask, c.o_mask);
+}
+
+/*Makes sp a spectator of s, taking a reference to s*/
+static int watch_attach(struct reversi_spectator *sp, struct reversi_session *s){
+    struct reversi_watch *w;
+
+    mutex_lock(&s->mutex);
+    if (s->watch == NULL){
+        w = kzalloc(sizeof(*w), GFP_KERNEL);
+        if (w == NULL){
+            mutex_unlock(&s->mutex);
+            return -ENOMEM;
+        }
+        seqlock_init(&w->lock);
+        init_waitqueue_head(&w->wait);
+        INIT_WORK(&w->wake, watch_wake);
+        w->size = s->size;
+        pack_board(s, &w->x_mask, &w->o_mask);
+        s->watch = w;
+    }
+    s->watch->watchers++;
+    mutex_unlock(&s->mutex);
+
+    kref_get(&s->ref);
+    sp->session = s;
+    sp->need_board = 1;
+    return 0;
+}
+
+static void watch_detach(struct reversi_spectator *sp){
+    struct reversi_session *s;
+
+    s = sp->session;
+    mutex_lock(&s->mutex);
+    s->watch->watchers--;
+    mutex_unlock(&s->mutex);
+
+    session_put(s);
+    sp->session = NULL;
+}
+
+/*1 if sp has something to read*/
+static int watch_available(struct reversi_spectator *sp){
+    return sp->need_board ||
+           (s32)(READ_ONCE(sp->session->watch->seq) - sp->next) >= 0;
+}
+
+static void watch_fill(struct reversi_watch_delta *d, u32 seq,
+                       const struct watch_change *c, char piece, bb128 mask){
+    d->seq = cpu_to_le32(seq);
+    d->kind = c->kind;
+    d->piece = piece;
+    d->square = c->square;
+    d->size = c->size;
+    d->mask = cpu_to_le64((u64)mask);
+    d->mask_high = cpu_to_le64((u64)(mask >> 64));
+}
+
+/*Takes up to max deltas for sp, returns how many. max is at least 2 so a
+  board always fits.*/
+static int watch_collect(struct reversi_spectator *sp,
+                         struct reversi_watch_delta *out, int max){
+    struct reversi_session *s;
+    struct reversi_watch *w;
+    struct watch_change c;
+    unsigned int start;
+    u32 seq;
+    u32 next;
+    int lagging;
+    int n;
+
+    s = sp->session;
+    w = s->watch;
+
+    for (;;){
+        if (sp->need_board){
+            /*Taken from the watch rather than the session, so a spectator
+              never waits on the mutex behind a search*/
+            c.kind = WATCH_BOARD;
+            c.square = MOVE_PASS;
+            do {
+                start = read_seqbegin(&w->lock);
+                c.size = w->size;
+                c.mask = w->x_mask;
+                c.o_mask = w->o_mask;
+                seq = w->seq;
+            } while (read_seqretry(&w->lock, start));
+
+            watch_fill(&out[0], seq, &c, 'X', c.mask);
+            watch_fill(&out[1], seq, &c, 'O', c.o_mask);
+            sp->next = seq + 1;
+            sp->need_board = 0;
+            return 2;
+        }
+
+        do {
+            start = read_seqbegin(&w->lock);
+            seq = w->seq;
+            next = sp->next;
+            n = 0;
+            lagging = seq - next + 1 > WATCH_RING && (s32)(seq - next) >= 0;
+
+            while (lagging == 0 && (s32)(seq - next) >= 0 && n < max){
+                c = w->ring[next % WATCH_RING];
+                if (c.kind == WATCH_BOARD){
+                    if (n + 2 > max){
+                        break;
+                    }
+                    watch_fill(&out[n++], next, &c, 'X', c.mask);
+                    watch_fill(&out[n++], next, &c, 'O', c.o_mask);
+                } else {
+                    watch_fill(&out[n++], next, &c, c.piece, c.mask);
+                }
+                next++;
+            }
+        } while (read_seqretry(&w->lock, start));
+
+        if (lagging){
+            sp->need_board = 1;
+            continue;
+        }
+        sp->next = next;
+        return n;
+    }
+}
+
+static int watch_open(struct inode *inodep, struct file *filep){
+    struct reversi_spectator *sp;
+
+    sp = kzalloc(sizeof(*sp), GFP_KERNEL);
+    if (sp == NULL){
+        return -ENOMEM;
+    }
+    mutex_init(&sp->lock);
+    filep->private_data = sp;
+    return nonseekable_open(inodep, filep);
+}
+
+static int watch_release(struct inode *inodep, struct file *filep){
+    struct reversi_spectator *sp;
+
+    sp = filep->private_data;
+    if (sp->session != NULL){
+        watch_detach(sp);
+    }
+    kfree(sp);
+    return 0;
+}
+
+/*Writing "id\n" attaches to a session, once per open*/
+static ssize_t watch_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos){
+    struct reversi_spectator *sp;
+    struct reversi_session *s;
+    struct session_table *t;
+    u32 id;
+    int check;
+
+    sp = filep->private_data;
+    check = kstrtou32_from_user(ubuf, count, 10, &id);
+    if (check != 0){
+        return check;
+    }
+
+    mutex_lock(&sp->lock);
+    if (sp->session != NULL){
+        mutex_unlock(&sp->lock);
+        return -EBUSY;
+    }
+
+    t = session_table(id);
+    down_read(&t->lock);
+    s = xa_load(&t->sessions, id / nr_node_ids);
+    if (s != NULL){
+        kref_get(&s->ref);
+    }
+    up_read(&t->lock);
+
+    if (s == NULL){
+        mutex_unlock(&sp->lock);
+        return -ENOENT;
+    }
+    check = watch_attach(sp, s);
+    mutex_unlock(&sp->lock);
+    session_put(s);
+
+    if (check != 0){
+        return check;
+    }
+    return count;
+}
+
+#define WATCH_BATCH 16
+
+/*Reads as many whole deltas as fit, waiting for the next change if there
+  are none*/
+static ssize_t watch_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos){
+    struct reversi_watch_delta batch[WATCH_BATCH];
+    struct reversi_spectator *sp;
+    size_t done;
+    int max;
+    int n;
+
+    sp = filep->private_data;
+    if (count < 2 * sizeof(batch[0])){
+        return -EINVAL;
+    }
+
+    if (mutex_lock_interruptible(&sp->lock) != 0){
+        return -ERESTARTSYS;
+    }
+    if (sp->session == NULL){
+        mutex_unlock(&sp->lock);
+        return -ENOTCONN;
+    }
+
+    while (watch_available(sp) == 0){
+        mutex_unlock(&sp->lock);
+        if (filep->f_flags & O_NONBLOCK){
+            return -EAGAIN;
+        }
+        if (wait_event_interruptible(sp->session->watch->wait,
+                                     watch_available(sp))){
+            return -ERESTARTSYS;
+        }
+        if (mutex_lock_interruptible(&sp->lock) != 0){
+            return -ERESTARTSYS;
+        }
+    }
+
+    done = 0;
+    while (count - done >= 2 * sizeof(batch[0]) && watch_available(sp)){
+        max = min_t(size_t, WATCH_BATCH, (count - done) / sizeof(batch[0]));
+        n = watch_collect(sp, batch, max);
+        if (n == 0){
+            break;
+        }
+        if (copy_to_user(ubuf + done, batch, n * sizeof(batch[0])) != 0){
+            mutex_unlock(&sp->lock);
+            return done > 0 ? done : -EFAULT;
+        }
+        done += n * sizeof(batch[0]);
+    }
+    mutex_unlock(&sp->lock);
+    return done;
+}
+
+static __poll_t watch_poll(struct file *filep, poll_table *wait){
+    struct reversi_spectator *sp;
+    __poll_t mask;
+
+    sp = filep->private_data;
+    mutex_lock(&sp->lock);
+    if (sp->session == NULL){
+        mutex_unlock(&sp->lock);
+        return EPOLLERR;
+    }
+    poll_wait(filep, &sp->session->watch->wait, wait);
+    mask = 0;
+    if (watch_available(sp)){
+        mask = EPOLLIN | EPOLLRDNORM;
+    }
+    mutex_unlock(&sp->lock);
+    return mask;
+}
+
+/*Bitboards used by the rules and the bot's search, one set of functions for
+  each board size from reversi_board.h*/
+#define BB_PASTE(n, name) bb##n##_##name
+#define BB_NAME(n, name) BB_PASTE(n, name)
+#define BB(name) BB_NAME(BOARD_N, name)
+
+/*The direction loops and the loops along a line have a fixed trip count for
+  each size, so they are unrolled*/
+#define BB_UNROLL _Pragma("GCC unroll 16")
+
+/*Classic square weights by how far the square is from the nearest edges,
+  corners good and the squares next to them bad. Anything more than 3 in
+  counts as 3, so 8x8 gets the usual table.*/
+static const s8 corner_weights[4][4] = {
+    { 100, -20,  10,   5 },
+    { -20, -50,  -2,  -2 },
+    {  10,  -2,  -1,  -1 },
+    {   5,  -2,  -1,  -1 },
+};
+
+#define SCORE_INF  1000000
+#define SCORE_DISC 1000 /*A finished game beats any evaluation*/
+
+struct search_ctx {
+    u64 deadline;
+    u64 nodes;
+    int aborted;
+    int simd; /*1 while the search holds the FPU for moves_simd*/
+};
+
+/*Checking the clock on every node would cost more than the nodes, so it is
+  only read every SEARCH_CHECK_NODES nodes*/
+#define SEARCH_CHECK_NODES 1024
+
+static void search_fpu_begin(struct search_ctx *ctx){
+    ctx->simd = 0;
+#ifdef BB_SIMD
+    if (static_branch_likely(&bb_simd_key) && irq_fpu_usable()){
+        kernel_fpu_begin();
+        ctx->simd = 1;
+    }
+#endif
+}
+
+static void search_fpu_end(struct search_ctx *ctx){
+#ifdef BB_SIMD
+    if (ctx->simd){
+        kernel_fpu_end();
+    }
+#endif
+}
+
+/*cond_resched for a search, which cannot sleep holding the FPU*/
+static void search_resched(struct search_ctx *ctx){
+#ifdef BB_SIMD
+    if (ctx->simd){
+        kernel_fpu_end();
+        cond_resched();
+        kernel_fpu_begin();
+        return;
+    }
+#endif
+    cond_resched();
+}
+
+/*Called by a search at the end of each depth. A running job is due again
+  bot_deadline_us from now, later if out of quota. If a queued job on the
+  worker's node is due before that, the job takes that as its deadline and
+  returns 1 to go back in the queue behind it. So however long a search
+  runs, a waiting move only waits for the depth in progress.*/
+static int search_yield(struct search_job *job){
+    struct search_node *sn;
+    struct rb_node *first;
+    u64 deadline;
+    int yield;
+
+    sn = job->worker;
+    if (sn == NULL){ /*Run directly, not by a worker*/
+        return 0;
+    }
+
+    deadline = max(job->deadline, ktime_get_ns() +
+                   (u64)READ_ONCE(bot_deadline_us) * NSEC_PER_USEC);
+    spin_lock(&sn->lock);
+    first = rb_first_cached(&sn->queue);
+    yield = first != NULL &&
+            rb_entry(first, struct search_job, node)->deadline < deadline;
+    spin_unlock(&sn->lock);
+
+    if (yield){
+        job->deadline = deadline;
+    }
+    return yield;
+}
+
+#define BOARD_N 6
+#include "reversi_board.h"
+#define BOARD_N 8
+#include "reversi_board.h"
+#define BOARD_N 10
+#include "reversi_board.h"
+
+static void build_weights(void){
+    bb6_build_weights();
+    bb8_build_weights();
+    bb10_build_weights();
+}
+
+/*Bit row * size + col of x_mask is set for every X and of o_mask for every O.
+  Not for the search, which packs into its own size's bitboards.*/
+static void pack_board(struct reversi_session *s, bb128 *x_mask, bb128 *o_mask){
+    int i;
+    int j;
+
+    *x_mask = 0;
+    *o_mask = 0;
+    for (i = 0; i < s->size; i++){
+        for (j = 0; j < s->size; j++){
+            if (s->gameboard[i][j] == 'X'){
+                *x_mask |= (bb128)1 << (i * s->size + j);
+            } else if (s->gameboard[i][j] == 'O'){
+                *o_mask |= (bb128)1 << (i * s->size + j);
+            }
+        }
+    }
+}
+
+/*The 8 symmetries of the 8x8 board. Bit 0 of sym transposes the board, bit 1
+  flips the rows and bit 2 flips the columns, applied in that order. Each
+  step undoes itself, so sym_undo runs them backwards.*/
+static u64 bb_transpose(u64 x){
+    u64 t;
+
+    t = 0x0f0f0f0f00000000ULL & (x ^ (x << 28));
+    x ^= t ^ (t >> 28);
+    t = 0x3333000033330000ULL & (x ^ (x << 14));
+    x ^= t ^ (t >> 14);
+    t = 0x5500550055005500ULL & (x ^ (x << 7));
+    x ^= t ^ (t >> 7);
+    return x;
+}
+
+static u64 bb_flip_cols(u64 x){
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+    return x;
+}
+
+static u64 sym_apply(u64 x, int sym){
+    if (sym & 1){
+        x = bb_transpose(x);
+    }
+    if (sym & 2){
+        x = swab64(x);
+    }
+    if (sym & 4){
+        x = bb_flip_cols(x);
+    }
+    return x;
+}
+
+static u64 sym_undo(u64 x, int sym){
+    if (sym & 4){
+        x = bb_flip_cols(x);
+    }
+    if (sym & 2){
+        x = swab64(x);
+    }
+    if (sym & 1){
+        x = bb_transpose(x);
+    }
+    return x;
+}
+
+/*Replaces P and O with the smallest of their 8 symmetric forms, so every
+  position equal under the symmetries has the same key. Returns the
+  symmetry used, to map squares back with sym_undo.*/
+static int canonical(u64 *P, u64 *O){
+    u64 best_p;
+    u64 best_o;
+    u64 p;
+    u64 o;
+    int best;
+    int sym;
+
+    best_p = *P;
+    best_o = *O;
+    best = 0;
+    for (sym = 1; sym < 8; sym++){
+        p = sym_apply(*P, sym);
+        o = sym_apply(*O, sym);
+        if (p < best_p || (p == best_p && o < best_o)){
+            best_p = p;
+            best_o = o;
+            best = sym;
+        }
+    }
+    *P = best_p;
+    *O = best_o;
+    return best;
+}
+
+static inline u32 position_hash(u64 P, u64 O, int bits){
+    return hash_64(P ^ rol64(O, 23), bits);
+}
+
+/*Opening book, lines of play from the start in the usual notation, column
+  letter then row number. Each position along a line maps to the move after
+  it, the first line listed winning when two lines disagree.*/
+static const char *const book_lines[] = {
+    "f5d6c3d3c4f4f6f3e6e7", /*Tiger*/
+    "f5d6c3d3c4f4c5b3c2e6c6b4", /*Buffalo*/
+    "f5d6c4d3c3",
+    "f5d6c5f4e3f6", /*Rose*/
+    "f5d6c5f4d3",
+    "f5d6c4g5",
+    "f5f6e6f4e3c5c6", /*Diagonal*/
+    "f5f6e6f4g5",
+    "f5f4e3f6d3", /*Parallel*/
+};
+
+/*Positions are stored in canonical form, so the book holds each opening
+  once however it was reached. BOOK_BITS leaves the table mostly empty.*/
+#define BOOK_BITS 8
+
+struct book_entry {
+    u64 P;
+    u64 O;
+    u8 sq;  /*Canonical square to play*/
+    u8 used;
+};
+
+static struct book_entry book[1 << BOOK_BITS];
+
+static void book_add(u64 P, u64 O, int sq){
+    u32 slot;
+    int sym;
+
+    sym = canonical(&P, &O);
+    slot = position_hash(P, O, BOOK_BITS);
+    while (book[slot].used){
+        if (book[slot].P == P && book[slot].O == O){
+            return;
+        }
+        slot = (slot + 1) & ((1 << BOOK_BITS) - 1);
+    }
+    book[slot].P = P;
+    book[slot].O = O;
+    book[slot].sq = __ffs64(sym_apply(1ULL << sq, sym));
+    book[slot].used = 1;
+}
+
+/*Finds the book move for P to play, returns -1 if the position is not in
+  the book*/
+static int book_lookup(u64 P, u64 O){
+    u32 slot;
+    int sym;
+
+    sym = canonical(&P, &O);
+    slot = position_hash(P, O, BOOK_BITS);
+    while (book[slot].used){
+        if (book[slot].P == P && book[slot].O == O){
+            return __ffs64(sym_undo(1ULL << book[slot].sq, sym));
+        }
+        slot = (slot + 1) & ((1 << BOOK_BITS) - 1);
+    }
+    return -1;
+}
+
+static void build_book(void){
+    const char *line;
+    u64 flips;
+    u64 P;
+    u64 O;
+    u64 t;
+    int sq;
+    int i;
+    int k;
+
+    for (i = 0; i < ARRAY_SIZE(book_lines); i++){
+        line = book_lines[i];
+        P = (1ULL << 28) | (1ULL << 35); /*X, who moves first*/
+        O = (1ULL << 27) | (1ULL << 36);
+
+        for (k = 0; line[k] != 0 && line[k+1] != 0; k += 2){
+            if (bb8_moves(P, O) == 0){ /*Pass*/
+                t = P;
+                P = O;
+                O = t;
+            }
+
+            sq = (line[k+1] - '1') * 8 + (line[k] - 'a');
+            if (sq < 0 || sq > 63 || (bb8_moves(P, O) & (1ULL << sq)) == 0){
+                printk(KERN_WARNING"reversi: bad book line %s\n", line);
+                break;
+            }
+
+            book_add(P, O, sq);
+            flips = bb8_flips(P, O, sq);
+            t = P | flips | (1ULL << sq);
+            P = O & ~flips;
+            O = t;
+        }
+    }
+}
+
+/*Exact endgame results shared by every session. A search that reaches the
+  end of the game stores its score and move, and the next search from that
+  position, or any symmetry of it, plays the move without searching. The
+  table is split into sets of ENDGAME_WAYS entries, and each set is covered
+  by one of ENDGAME_STRIPES locks. When a set is full a CLOCK hand goes round
+  it. Each entry hit since the hand last passed gets its ref bit cleared and
+  is kept, and the first entry without one is replaced. New entries start
+  with the bit clear, so results nobody asks for again go first.*/
+#define ENDGAME_WAYS    4
+#define ENDGAME_STRIPES 256
+
+struct endgame_entry {
+    u64 P;
+    u64 O;
+    s32 score; /*For P, exact*/
+    u8 sq;     /*Canonical square to play*/
+    u8 used;
+    u8 ref;    /*Hit since the hand last passed*/
+};
+
+struct endgame_set {
+    struct endgame_entry entry[ENDGAME_WAYS];
+    u8 hand;
+};
+
+struct endgame_cache {
+    struct endgame_set *sets;
+    unsigned int bits;
+    spinlock_t locks[ENDGAME_STRIPES];
+    struct endgame_stats __percpu *stats;
+};
+
+static struct endgame_cache *alloc_endgame_cache(unsigned int kb){
+    struct endgame_cache *cache;
+    unsigned long sets;
+    int i;
+
+    cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+    if (cache == NULL){
+        return NULL;
+    }
+    sets = rounddown_pow_of_two(max_t(unsigned long,
+                                      kb * 1024UL / sizeof(struct endgame_set),
+                                      ENDGAME_STRIPES));
+    cache->sets = kvcalloc(sets, sizeof(struct endgame_set), GFP_KERNEL);
+    cache->stats = alloc_percpu(struct endgame_stats);
+    if (cache->sets == NULL || cache->stats == NULL){
+        free_percpu(cache->stats);
+        kvfree(cache->sets);
+        kfree(cache);
+        return NULL;
+    }
+    cache->bits = ilog2(sets);
+    for (i = 0; i < ENDGAME_STRIPES; i++){
+        spin_lock_init(&cache->locks[i]);
+    }
+    return cache;
+}
+
+static void free_endgame_cache(struct endgame_cache *cache){
+    if (cache == NULL){
+        return;
+    }
+    free_percpu(cache->stats);
+    kvfree(cache->sets);
+    kfree(cache);
+}
+
+static void endgame_stats_sum(struct endgame_cache *cache,
+                              struct endgame_stats *sum){
+    struct endgame_stats *st;
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    if (cache == NULL){
+        return;
+    }
+    for_each_possible_cpu(cpu){
+        st = per_cpu_ptr(cache->stats, cpu);
+        sum->hits += READ_ONCE(st->hits);
+        sum->misses += READ_ONCE(st->misses);
+        sum->evictions += READ_ONCE(st->evictions);
+    }
+}
+
+static int endgame_lookup(struct endgame_cache *cache, u64 P, u64 O){
+    struct endgame_entry *e;
+    spinlock_t *stripe;
+    u32 slot;
+    int sym;
+    int sq;
+    int i;
+
+    if (cache == NULL){
+        return -1;
+    }
+
+    sym = canonical(&P, &O);
+    slot = position_hash(P, O, cache->bits);
+    stripe = &cache->locks[slot & (ENDGAME_STRIPES - 1)];
+    sq = -1;
+
+    spin_lock(stripe);
+    for (i = 0; i < ENDGAME_WAYS; i++){
+        e = &cache->sets[slot].entry[i];
+        if (e->used && e->P == P && e->O == O){
+            e->ref = 1;
+            sq = e->sq;
+            break;
+        }
+    }
+    spin_unlock(stripe);
+
+    if (sq < 0){
+        this_cpu_inc(cache->stats->misses);
+        return -1;
+    }
+    this_cpu_inc(cache->stats->hits);
+    return __ffs64(sym_undo(1ULL << sq, sym));
+}
+
+static void endgame_store(struct endgame_cache *cache, u64 P, u64 O,
+                          int score, int sq){
+    struct endgame_set *set;
+    struct endgame_entry *e;
+    spinlock_t *stripe;
+    u32 slot;
+    int evicted;
+    int sym;
+    int i;
+
+    if (cache == NULL){
+        return;
+    }
+
+    sym = canonical(&P, &O);
+    sq = __ffs64(sym_apply(1ULL << sq, sym));
+    slot = position_hash(P, O, cache->bits);
+    set = &cache->sets[slot];
+    stripe = &cache->locks[slot & (ENDGAME_STRIPES - 1)];
+    evicted = 0;
+
+    spin_lock(stripe);
+    /*The same position again, or else a free entry*/
+    e = NULL;
+    for (i = 0; i < ENDGAME_WAYS; i++){
+        if (!set->entry[i].used){
+            if (e == NULL){
+                e = &set->entry[i];
+            }
+        } else if (set->entry[i].P == P && set->entry[i].O == O){
+            e = &set->entry[i];
+            break;
+        }
+    }
+    /*Every ref bit is clear by the second time round*/
+    while (e == NULL){
+        e = &set->entry[set->hand];
+        set->hand = (set->hand + 1) % ENDGAME_WAYS;
+        if (e->ref){
+            e->ref = 0;
+            e = NULL;
+        } else {
+            evicted = 1;
+        }
+    }
+    e->P = P;
+    e->O = O;
+    e->score = score;
+    e->sq = sq;
+    e->used = 1;
+    spin_unlock(stripe);
+
+    if (evicted){
+        this_cpu_inc(cache->stats->evictions);
+    }
+}
+
+/*Runs the search for the session's board size*/
+static void search_bot_move(struct search_job *job){
+    switch (job->s->size){
+    case 6:
+        bb6_search(job);
+        break;
+    case 10:
+        bb10_search(job);
+        break;
+    default:
+        bb8_search(job);
+        break;
+    }
+}
+
+/*Finds an idle worker on sn and marks it busy, under sn->lock*/
+static struct search_worker *search_idle_worker(struct search_node *sn){
+    unsigned int i;
+
+    for (i = 0; i < sn->pool_size; i++){
+        if (sn->pool[i].busy == 0){
+            sn->pool[i].busy = 1;
+            return &sn->pool[i];
+        }
+    }
+    return NULL;
+}
 
-/*This function branches off of check_adj_cells, it flips the pieces if a 
-  valid move is found. empty_row and empty_col are the potential spot a piece
-  can be placed. opp_row and opp_col are the spot where an opponent's piece
-  was found, meaning I know what direction to look. Validate is used for checking 
-  if there are any valid moves, used when a player/bot has to pass their turn.*/
-int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col,
-                   char piece, int validate);
+/*Adds job to sn's queue in deadline order, under sn->lock*/
+static void search_insert(struct search_node *sn, struct search_job *job){
+    struct rb_node **link;
+    struct rb_node *parent;
+    struct search_job *entry;
+    bool leftmost;
 
-/*This function checks all 8 surrounding cells. If any of them is an opponent's
-  piece, call check_and_flip. Again, validate is used for checking if a turn
-  can be passed. */
-int check_adj_cells(int row, int col, char piece, int validate);
+    parent = NULL;
+    leftmost = true;
+    link = &sn->queue.rb_root.rb_node;
+    while (*link != NULL){
+        parent = *link;
+        entry = rb_entry(parent, struct search_job, node);
+        if (job->deadline < entry->deadline){
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&job->node, parent, link);
+    rb_insert_color_cached(&job->node, &sn->queue, leftmost);
+    WRITE_ONCE(sn->queued, sn->queued + 1);
+}
 
-/*Prints output to userspace*/
-void output(char* string, int length); 
+/*Takes the earliest job off sn's queue, under sn->lock*/
+static struct search_job *search_pop(struct search_node *sn){
+    struct rb_node *node;
 
-/*Checks if there are any valid moves for the current player*/
-int check_for_valid_moves(char piece);
+    node = rb_first_cached(&sn->queue);
+    if (node == NULL){
+        return NULL;
+    }
+    rb_erase_cached(node, &sn->queue);
+    WRITE_ONCE(sn->queued, sn->queued - 1);
+    return rb_entry(node, struct search_job, node);
+}
 
-/*Checks if the game has ended*/
-int check_game_end(void);
+/*Takes the earliest job of the first node after node in nodes with one
+  queued. Only the queued counts are read without the lock, so nodes with
+  nothing queued are passed over without writing to their cache lines.*/
+static struct search_job *search_steal(struct search_node **nodes, int node){
+    struct search_node *sn;
+    struct search_job *job;
+    int i;
 
-/*Counts the pieces and determines a winner if the game has ended*/
-int count_pieces(void);
+    for (i = 1; i < nr_node_ids; i++){
+        sn = nodes[(node + i) % nr_node_ids];
+        if (READ_ONCE(sn->queued) == 0){
+            continue;
+        }
+        spin_lock(&sn->lock);
+        job = search_pop(sn);
+        spin_unlock(&sn->lock);
+        if (job != NULL){
+            return job;
+        }
+    }
+    return NULL;
+}
 
-/*Main function to run the game*/
-int start(int length);
+/*Queues job on its session's node and wakes a worker for it. With every
+  worker on the node busy, an idle one on another node steals the job. With
+  none idle anywhere a busy one picks it up when it finishes.*/
+static void search_submit(struct search_job *job){
+    struct search_worker *kick;
+    struct search_node *sn;
+    int home;
+    int i;
 
-char kern_buf [120];
-char gameboard[8][8];
-char turn;
-char player;
-char bot;
-int game_flag;
-int game_print_end;
+    home = search_nodes[job->s->node]->home;
+    sn = search_nodes[home];
 
-static DECLARE_RWSEM(lock);
+    spin_lock(&sn->lock);
+    search_insert(sn, job);
+    kick = search_idle_worker(sn);
+    spin_unlock(&sn->lock);
 
-static const struct file_operations fops = {
-    .owner = THIS_MODULE,
-    .open = reversi_open,
-    .release = reversi_release,
-    .read = reversi_read,
-    .write = reversi_write,
-    .llseek = no_llseek,
-};
+    for (i = 1; kick == NULL && i < nr_node_ids; i++){
+        sn = search_nodes[(home + i) % nr_node_ids];
+        if (sn->pool_size == 0){
+            continue;
+        }
+        spin_lock(&sn->lock);
+        kick = search_idle_worker(sn);
+        spin_unlock(&sn->lock);
+    }
 
-static struct miscdevice reversi_device = {
-    .minor = MISC_DYNAMIC_MINOR,
-    .name = "reversi",
-    .fops = &fops,
-    .mode = 0666, /*Gives correct permissions*/
-};
+    if (kick != NULL){
+        queue_work_node(kick->node, search_wq, &kick->work);
+    }
+}
 
-/*Initialization function for the device*/
-static int __init reversi_init(void){
+/*Runs queued jobs earliest deadline first, the worker's own node's before
+  any other's, until every queue is empty. A job that yields goes back in
+  the queue to finish later.*/
+static void search_work(struct work_struct *work){
+    struct search_worker *w;
+    struct search_node *sn;
+    struct search_job *job;
+    u64 begin;
 
-    int check;
-    check = misc_register(&reversi_device);
-    if(check != 0){
-        printk(KERN_ALERT"ERROR!\n");
-        return check;
+    w = container_of(work, struct search_worker, work);
+    sn = search_nodes[w->node];
+
+    for (;;){
+        spin_lock(&sn->lock);
+        job = search_pop(sn);
+        spin_unlock(&sn->lock);
+
+        if (job == NULL){
+            job = search_steal(search_nodes, w->node);
+        }
+        if (job == NULL){
+            /*Looked at again under the lock, as a job queued here since
+              saw this worker busy and did not kick it*/
+            spin_lock(&sn->lock);
+            job = search_pop(sn);
+            if (job == NULL){
+                w->busy = 0;
+            }
+            spin_unlock(&sn->lock);
+            if (job == NULL){
+                return;
+            }
+        }
+
+        job->worker = sn;
+        begin = ktime_get_ns();
+        search_bot_move(job);
+        job->run_ns += ktime_get_ns() - begin;
+        job->worker = NULL;
+
+        if (job->yielded){
+            search_submit(job);
+        } else {
+            complete(&job->done); /*job is gone after this*/
+        }
+
+        cond_resched();
     }
+}
 
-    return 0;
+/*Search time s may use per period in usecs, 0 for no limit*/
+static u32 session_quota_us(struct reversi_session *s){
+    if (s->quota_set){
+        return s->quota_us;
+    }
+    return READ_ONCE(bot_quota_us);
 }
 
-/*Uninitialization function*/
-static void __exit reversi_exit(void){
-    misc_deregister(&reversi_device);
+static void run_bot_search(struct reversi_session *s, u32 budget_us,
+                           struct search_job *job){
+    u64 period;
+    u32 quota;
+    u64 now;
+
+    now = ktime_get_ns();
+    period = (u64)READ_ONCE(bot_period_ms) * NSEC_PER_MSEC;
+    if (now - s->period_start >= period){
+        s->period_start = now;
+        s->period_used_ns = 0;
+    }
+
+    job->s = s;
+    job->run_ns = 0;
+    job->yielded = 0;
+    job->worker = NULL;
+    job->endgame = endgame_cache;
+    job->fixed_depth = READ_ONCE(bot_depth);
+    job->book = READ_ONCE(bot_book);
+    init_completion(&job->done);
+    job->search_deadline = now + (u64)min_t(u32, budget_us, BOT_MAX_BUDGET_US) *
+                           NSEC_PER_USEC;
+    job->deadline = now + (u64)READ_ONCE(bot_deadline_us) * NSEC_PER_USEC;
+    quota = session_quota_us(s);
+    if (quota != 0 && s->period_used_ns >= (u64)quota * NSEC_PER_USEC){
+        /*Out of quota, queue behind everyone still within theirs*/
+        job->deadline += s->period_start + period - now;
+    }
+
+    search_submit(job);
+    wait_for_completion(&job->done);
+
+    s->period_used_ns += job->run_ns;
 }
 
-/*Function that runs when the device is opened*/
-static int reversi_open(struct inode *inodep, struct file *filep){
-    printk(KERN_ALERT"Reversi device opened\n");
-    game_flag = 0;
-    return 0;
+static void new_game(struct reversi_session *s, char player, int size){
+    int mid;
+    int i;
+    int j;
+
+    s->player = player;
+    if (s->player == 'X'){
+        s->bot = 'O';
+    } else {
+        s->bot = 'X';
+    }
+
+    s->turn = 'X'; /*X always goes first*/
+    s->size = size;
+
+    for(i = 0; i < size; i++){
+        for (j = 0; j < size; j++){
+            s->gameboard[i][j] = '-';
+        }
+    }
+
+    /*Set starting pieces*/
+    mid = size / 2;
+    s->gameboard[mid-1][mid-1] = 'O';
+    s->gameboard[mid-1][mid] = 'X';
+    s->gameboard[mid][mid-1] = 'X';
+    s->gameboard[mid][mid] = 'O';
+
+    s->game_flag = 1;
+    s->game_print_end = 0;
+
+    s->nmoves = 0;
+    s->moves_partial = 0;
+    s->last_move_ns = ktime_get_ns();
+    watch_board(s);
 }
 
-/*Function that runs when device is closed*/
-static int reversi_release(struct inode *inodep, struct file *filep){
-    printk(KERN_ALERT"Reversi device released\n");
+static int finish_move(struct reversi_session *s, int square){
+    log_move(s, square);
+    if (check_game_end(s) == 1){ /*Game is over*/
+        count_pieces(s);
+        s->game_flag = 0;
+        s->game_print_end = 1;
+        return 1;
+    }
     return 0;
 }
 
-/*Device read function*/
-static ssize_t reversi_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos){
+static int play_bot_move(struct reversi_session *s, u32 budget_us,
+                         struct search_job *job){
+    int check;
 
-    int var; 
-    down_read(&lock);
-    if(count > sizeof(kern_buf)){
-        count = sizeof(kern_buf);
+    check = 0;
+    run_bot_search(s, budget_us, job);
+    if (job->row >= 0){
+        check = check_adj_cells(s, job->row, job->col, s->turn, 0);
+    }
+    if (check != 1){
+        return 0;
     }
 
-    var = copy_to_user(ubuf, kern_buf, count);
-    up_read(&lock);
+    finish_move(s, job->row * s->size + job->col);
+    return 1;
+}
+
+/*Plays a random move for the side to move, returns 0 if it has none*/
+static int play_random_move(struct reversi_session *s, struct rnd_state *rnd){
+    u8 squares[BOARD_MAX * BOARD_MAX];
+    int row;
+    int col;
+    int sq;
+    int n;
 
-    return 67;
+    n = 0;
+    for (row = 0; row < s->size; row++){
+        for (col = 0; col < s->size; col++){
+            if (s->gameboard[row][col] == '-' &&
+                check_adj_cells(s, row, col, s->turn, 1) == 1){
+                squares[n++] = row * s->size + col;
+            }
+        }
+    }
+    if (n == 0){
+        return 0;
+    }
+
+    sq = squares[prandom_u32_state(rnd) % n];
+    check_adj_cells(s, sq / s->size, sq % s->size, s->turn, 0);
+    finish_move(s, sq);
+    return 1;
 }
 
-/*Device write function*/
-static ssize_t reversi_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos){
-    int var;
-    
-    down_write(&lock);
-    if (count > sizeof(kern_buf)){
-        count = sizeof(kern_buf);
+/*Totals for the 06 command*/
+struct self_play_result {
+    u32 games;
+    u32 x_wins;
+    u32 o_wins;
+    u32 ties;
+    u64 moves;
+    u64 nodes;
+    u64 ns;
+};
+
+/*Plays games bot against bot on a session of their own, going through the
+  same session mutex and search workers as the 03 command for every move.
+  The first random_plies moves of each game are random so the games differ.
+  Stops early on a fatal signal with the games finished so far.*/
+static int self_play(int size, u32 games, u32 budget_us, u32 random_plies,
+                     struct self_play_result *res){
+    struct reversi_session *g;
+    struct search_job job;
+    struct rnd_state rnd;
+    bb128 x_mask;
+    bb128 o_mask;
+    u64 begin;
+    int moved;
+    int over;
+    int x;
+    int o;
+    u32 ply;
+
+    memset(res, 0, sizeof(*res));
+    g = alloc_session(numa_node_id());
+    if (g == NULL){
+        return -ENOMEM;
     }
+    g->self_play = 1;
+    prandom_seed_state(&rnd, get_random_u64());
 
-    var = copy_from_user(kern_buf, ubuf, count);
-    start(count);
-    printk("Count is %zu\n", count);
-    up_write(&lock);
+    begin = ktime_get_ns();
+    while (res->games < games && fatal_signal_pending(current) == 0){
+        mutex_lock(&g->mutex);
+        new_game(g, 'X', size);
+        mutex_unlock(&g->mutex);
 
-    return count;
+        ply = 0;
+        do {
+            /*A bot move can take the whole budget, so a kill is checked
+              before each one rather than once a game*/
+            if (fatal_signal_pending(current)){
+                break;
+            }
+            mutex_lock(&g->mutex);
+            if (ply < random_plies){
+                moved = play_random_move(g, &rnd);
+            } else {
+                moved = play_bot_move(g, budget_us, &job);
+                res->nodes += job.nodes;
+            }
+            if (moved == 0){ /*Pass, the other side has a move*/
+                log_move(g, MOVE_PASS);
+            } else {
+                res->moves++;
+            }
+            g->turn = g->turn == 'X' ? 'O' : 'X';
+            over = g->game_flag == 0;
+            mutex_unlock(&g->mutex);
+            ply++;
+        } while (over == 0);
+        if (over == 0){ /*Killed, the game is not counted*/
+            break;
+        }
+
+        pack_board(g, &x_mask, &o_mask);
+        x = hweight64((u64)x_mask) + hweight64((u64)(x_mask >> 64));
+        o = hweight64((u64)o_mask) + hweight64((u64)(o_mask >> 64));
+        if (x > o){
+            res->x_wins++;
+        } else if (x < o){
+            res->o_wins++;
+        } else {
+            res->ties++;
+        }
+        res->games++;
+    }
+    res->ns = ktime_get_ns() - begin;
+
+    session_put(g);
+    return 0;
+}
+
+/*count per second over ns*/
+static u64 self_play_rate(u64 count, u64 ns){
+    if (ns == 0){
+        return 0;
+    }
+    return mul_u64_u64_div_u64(count, NSEC_PER_SEC, ns);
 }
 
-void output(char* string, int length){
+void output(struct reversi_session *s, char* string, int length){
     int index = 0;
     int size = 80;
     
     for (index = 0; index < length; index++){
-        kern_buf[index] = string[index];
+        s->kern_buf[index] = string[index];
     }
 
     for(index = length; index < size; index++){
-        kern_buf[index] = 0;
+        s->kern_buf[index] = 0;
+    }
+    s->out_len = length;
+}
+
+/*Makes room in the reply queue for the longest reply. Returns -EAGAIN when
+  the queue is at the file's reply_kb and has to be read first.*/
+static int reserve_reply(struct reversi_file *rf){
+    size_t want;
+    size_t limit;
+    size_t size;
+    char *buf;
+
+    want = sizeof(rf->session->kern_buf) + 1;
+    limit = max_t(size_t, rf->reply_kb * 1024UL, 2 * want);
+    if (rf->reply_tail - rf->reply_head + want > limit){
+        return -EAGAIN;
+    }
+
+    if (rf->reply_head == rf->reply_tail){
+        rf->reply_head = 0;
+        rf->reply_tail = 0;
+    }
+    if (rf->reply_size - rf->reply_tail >= want){
+        return 0;
+    }
+
+    /*Slide what is left to the front before growing*/
+    if (rf->reply_head > 0){
+        memmove(rf->replies, rf->replies + rf->reply_head,
+                rf->reply_tail - rf->reply_head);
+        rf->reply_tail -= rf->reply_head;
+        rf->reply_head = 0;
+        if (rf->reply_size - rf->reply_tail >= want){
+            return 0;
+        }
+    }
+
+    size = max3(2 * rf->reply_size, rf->reply_tail + want, (size_t)256);
+    size = min(size, limit);
+
+    buf = krealloc(rf->replies, size, GFP_KERNEL);
+    if (buf == NULL){
+        return -ENOMEM;
+    }
+    rf->replies = buf;
+    rf->reply_size = size;
+    return 0;
+}
+
+/*Adds a reply to the queue, ending it with a newline if it has none. There
+  is always room after reserve_reply.*/
+static void queue_reply(struct reversi_file *rf, const char *reply, int len){
+    size_t start;
+
+    start = rf->reply_tail;
+    memcpy(rf->replies + rf->reply_tail, reply, len);
+    rf->reply_tail += len;
+    if (len == 0 || reply[len-1] != '\n'){
+        rf->replies[rf->reply_tail] = '\n';
+        rf->reply_tail++;
+    }
+    trace_event(rf, TRACE_REPLY, rf->replies + start, rf->reply_tail - start);
+}
+
+/*Runs each command in buf in order. With more set the last line is only run
+  once its newline shows up, in a later chunk. Blank lines are skipped.
+  Returns the bytes used, or an error if not even the first command could
+  run. Called with rf->lock held.*/
+static ssize_t run_commands(struct reversi_file *rf, const char *buf,
+                            size_t len, int more){
+    struct reversi_session *s;
+    const char *nl;
+    size_t done;
+    size_t line;
+    int check;
+
+    s = rf->session;
+    mutex_lock(&s->mutex);
+
+    check = 0;
+    done = 0;
+    while (done < len){
+        nl = memchr(buf + done, '\n', len - done);
+        if (nl != NULL){
+            line = nl - (buf + done) + 1;
+        } else if (more){
+            break;
+        } else {
+            line = len - done;
+        }
+
+        if (line == 1 && nl != NULL){
+            done++;
+            continue;
+        }
+
+        check = reserve_reply(rf);
+        if (check != 0){
+            break;
+        }
+
+        trace_event(rf, TRACE_COMMAND, buf + done, line);
+        if (line >= sizeof(s->kern_buf)){
+            queue_reply(rf, "INVFMT", 6);
+        } else {
+            /*Ended so a last line with no newline never reads the reply
+              left behind by the command before it*/
+            memcpy(s->kern_buf, buf + done, line);
+            s->kern_buf[line] = '\0';
+            start(rf, line);
+
+            /*05 moved this file to another session*/
+            if (rf->session != s){
+                mutex_unlock(&s->mutex);
+                session_put(s);
+                s = rf->session;
+                mutex_lock(&s->mutex);
+            }
+            queue_reply(rf, s->kern_buf, s->out_len);
+        }
+        done += line;
+    }
+
+    mutex_unlock(&s->mutex);
+    if (done == 0 && check != 0){
+        return check;
     }
+    return done;
 }
 
-int start(int length){
+int start(struct reversi_file *rf, int length){
+    struct reversi_session *s;
+
+    s = rf->session;
+
     /*Command always has a 0 in front*/
-    if (kern_buf[0] != '0'){
-        output("INVFMT", 6);
+    if (s->kern_buf[0] != '0'){
+        output(s, "INVFMT", 6);
         return -1;
     }
 
-    /*Command cannot be longer than 7*/
-    if (length > 7){
-        output("INVFMT", 6);
+    /*Command cannot be longer than 7, other than 00, 03, 05, 06 and 07
+      which can carry numbers*/
+    if (length > 7 && s->kern_buf[1] != '0' && s->kern_buf[1] != '3' &&
+        s->kern_buf[1] != '5' && s->kern_buf[1] != '6' &&
+        s->kern_buf[1] != '7'){
+        output(s, "INVFMT", 6);
         return -1;
     }
 
-    /*Start game command (00)*/
-    if (kern_buf[1] == '0'){
-        int i;
-        int j;
+    /*Start game command (00), "00 X 6\n" plays on a 6x6 board instead of
+      the usual 8x8*/
+    if (s->kern_buf[1] == '0'){
+        u32 size;
         
-        if (kern_buf[2] != ' '){
-            output("INVFMT", 6);
+        if (s->kern_buf[2] != ' '){
+            output(s, "INVFMT", 6);
             return -1;
         }
-        if (kern_buf[3] != 'X' && kern_buf[3] != 'O'){
-            output("INVFMT", 6);
+        if (s->kern_buf[3] != 'X' && s->kern_buf[3] != 'O'){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        player = kern_buf[3];
-        if (player == 'X'){
-            bot = 'O';
-        } else {
-            bot = 'X';
-        }
-
-        turn = 'X'; /*X always goes first*/
-
-        for(i = 0; i < 8; i++){
-            for (j = 0; j < 8; j++){
-                gameboard[i][j] = '-';
+        /*Only a size or the newline may follow the color, and a last
+          command with no newline can end right after it*/
+        size = 8;
+        if (s->kern_buf[4] == ' '){
+            if (parse_arg(s, 5, length, &size) != 0 || board_size_ok(size) == 0){
+                output(s, "INVFMT", 6);
+                return -1;
             }
+        } else if (length != 4 && (length != 5 || s->kern_buf[4] != '\n')){
+            output(s, "INVFMT", 6);
+            return -1;
         }
 
-        /*Set starting pieces*/
-        gameboard[3][3] = 'O';
-        gameboard[3][4] = 'X';
-        gameboard[4][3] = 'X';
-        gameboard[4][4] = 'O';
-
-        game_flag = 1;
-        game_print_end = 0;
-
-        output("OK", 2);
+        new_game(s, s->kern_buf[3], size);
+        output(s, "OK", 2);
 
     /*Print board command (01)*/
-    } else if (kern_buf[1] == '1'){
+    } else if (s->kern_buf[1] == '1'){
         int i;
         int j;
         int index;
-        char print_buf[67];
+        char print_buf[BOARD_MAX * BOARD_MAX + 3];
         
-        if (kern_buf[2] != '\n'){
-            output("INVFMT", 6);
+        if (s->kern_buf[2] != '\n'){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        if (game_flag == 0 && game_print_end != 1){
-            output("NO GAME", 7);
+        if (s->game_flag == 0 && s->game_print_end != 1){
+            output(s, "NO GAME", 7);
             return -1;
         }
 
         index = 0;
 
-        for(i = 0; i < 8; i++){
-            for(j = 0; j < 8; j++){
-                print_buf[index] = gameboard[i][j];
+        for(i = 0; i < s->size; i++){
+            for(j = 0; j < s->size; j++){
+                print_buf[index] = s->gameboard[i][j];
                 index++;
             }
         }
 
-        print_buf[64] = '\t';
-        print_buf[65] = turn;
-        print_buf[66] = '\n';
+        print_buf[index] = '\t';
+        print_buf[index+1] = s->turn;
+        print_buf[index+2] = '\n';
 
-        output(print_buf, 67);
+        output(s, print_buf, index + 3);
 
     /*Place piece command (02)*/
-    } else if (kern_buf[1] == '2'){
+    } else if (s->kern_buf[1] == '2'){
         char row_c;
         char col_c;
         int  row;
@@ -244,157 +3232,307 @@ int start(int length){
 
         check = 0;
 
-        if (kern_buf[2] != ' '){
-            output("INVFMT", 6);
+        if (s->kern_buf[2] != ' '){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        if (kern_buf[4] != ' '){
-            output("INVFMT", 6);
+        if (s->kern_buf[4] != ' '){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        if (kern_buf[6] != '\n'){
-            output("INVFMT", 6);
+        if (s->kern_buf[6] != '\n'){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        if (turn != player){
-            output("OOT", 3);
+        if (s->turn != s->player){
+            output(s, "OOT", 3);
             return -1;
         }
 
-        if (game_flag == 0){
-            output("NO GAME", 7);
+        if (s->game_flag == 0){
+            output(s, "NO GAME", 7);
             return -1;
         }
 
-        col_c = kern_buf[3];
-        row_c = kern_buf[5];
+        col_c = s->kern_buf[3];
+        row_c = s->kern_buf[5];
 
         col = col_c - 48;
         row = row_c - 48;
 
-        if (col < 0 || col > 7){
-            output("ILLMOVE", 7);
-        } else if (row < 0 || row > 7){
-            output("ILLMOVE", 7);
+        if (col < 0 || col >= s->size){
+            output(s, "ILLMOVE", 7);
+        } else if (row < 0 || row >= s->size){
+            output(s, "ILLMOVE", 7);
         } else {
-            if (gameboard[row][col] != '-'){
-                output("ILLMOVE", 7);
+            if (s->gameboard[row][col] != '-'){
+                output(s, "ILLMOVE", 7);
             } else {
-                check = check_adj_cells(row, col, turn, 0);
+                check = check_adj_cells(s, row, col, s->turn, 0);
             }
 
             if (check == 0){
-                output("ILLMOVE", 7);
+                output(s, "ILLMOVE", 7);
             } else {
-                end = 0;
-                end = check_game_end();
-                if (end == 1){ /*Game is over*/
-                    count_pieces();
-                    game_flag = 0;
-                    game_print_end = 1;
-                } else {
-                    turn = bot;
-                    output("OK", 2);
+                end = finish_move(s, row * s->size + col);
+                if (end == 0){
+                    s->turn = s->bot;
+                    output(s, "OK", 2);
                 }
 
             }
             
         }
 
-    /*Bot move command (03)*/ 
-    } else if (kern_buf[1] == '3'){
-        int check;
-        int flag;
-        int end;
-        int i;
-        int j;
+    /*Bot move command (03), "03 usecs\n" sets the search time and replies
+      with the depth reached and nodes searched*/
+    } else if (s->kern_buf[1] == '3'){
+        struct search_job job;
+        char reply[32];
+        u32 budget_us;
+        int verbose;
+        int len;
         
-        if (kern_buf[2] != '\n'){
-            output("INVFMT", 6);
+        budget_us = READ_ONCE(bot_budget_us);
+        if (s->kern_buf[2] != '\n' && parse_arg(s, 3, length, &budget_us) != 0){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        if (turn != bot){
-            output("OOT", 3);
+        if (s->turn != s->bot){
+            output(s, "OOT", 3);
             return -1;
         }
 
-        if (game_flag == 0){
-            output("NO GAME", 7);
+        if (s->game_flag == 0){
+            output(s, "NO GAME", 7);
             return -1;
         }
 
-        flag = 0;
-        check = 0;
+        /*Read before the move, the reply overwrites the command when the
+          game ends*/
+        verbose = s->kern_buf[2] == ' ';
 
-        for(i = 0; i < 8; i++){
-            for (j = 0; j < 8; j++){
-                if (gameboard[i][j] == '-'){
-                    check = check_adj_cells(i,j,turn, 0);
-                    if (check == 1){
-                        end = 0;
-                        end = check_game_end();
-                        if (end == 1){ /*Game is over*/
-                            count_pieces();
-                            game_flag = 0;
-                            game_print_end = 1;
-                        } else {
-                            output("OK", 2);
-                            turn = player;
-                        }
-                        break;
-                    }
-                }
-            }
-            if (check == 1){
-                break;
+        if (play_bot_move(s, budget_us, &job) == 0){
+            output(s, "ILLMOVE", 7);
+        } else if (s->game_flag == 1){
+            if (verbose == 1){
+                len = snprintf(reply, sizeof(reply), "OK %d %llu", job.depth,
+                               job.nodes);
+                output(s, reply, len);
+            } else {
+                output(s, "OK", 2);
             }
-        }
-
-        if (check == 0){
-            output("ILLMOVE", 7);
+            s->turn = s->player;
         }
 
     /*Skip turn command (04)*/
-    } else if (kern_buf[1] == '4'){
+    } else if (s->kern_buf[1] == '4'){
         int check;
 
-        if (kern_buf[2] != '\n'){
-            output("INVFMT", 6);
+        if (s->kern_buf[2] != '\n'){
+            output(s, "INVFMT", 6);
             return -1;
         }
 
-        if (game_flag == 0){
-            output("NO GAME", 7);
+        if (s->game_flag == 0){
+            output(s, "NO GAME", 7);
             return -1;
         }
 
         check = 0;
-        check = check_for_valid_moves(turn);
+        check = check_for_valid_moves(s, s->turn);
 
         if (check == 0){
-            output("OK", 2);
-            if (turn == player){
-                turn = bot;
-            } else if (turn == bot){
-                turn = player;
+            log_move(s, MOVE_PASS);
+            output(s, "OK", 2);
+            if (s->turn == s->player){
+                s->turn = s->bot;
+            } else if (s->turn == s->bot){
+                s->turn = s->player;
             }
         } else if (check == 1){
-            output("ILLMOVE", 7);
+            output(s, "ILLMOVE", 7);
+        }
+
+    /*Session command (05), "05\n" returns this session's id and "05 id\n"
+      resumes a saved game*/
+    } else if (s->kern_buf[1] == '5'){
+        struct reversi_session *found;
+        struct session_table *t;
+        char id_buf[12];
+        u32 id;
+        int len;
+
+        if (s->kern_buf[2] == '\n'){
+            len = snprintf(id_buf, sizeof(id_buf), "%u", s->id);
+            output(s, id_buf, len);
+            return 0;
+        }
+
+        if (parse_arg(s, 3, length, &id) != 0){
+            output(s, "INVFMT", 6);
+            return -1;
+        }
+
+        /*A detached session is left alone by everything but saving, which
+          only reads it, so its game can be checked under its table's lock
+          alone*/
+        t = session_table(id);
+        down_write(&t->lock);
+        found = xa_load(&t->sessions, id / nr_node_ids);
+        if (found == NULL || found->attached == 1 || found->game_flag == 0){
+            up_write(&t->lock);
+            output(s, "NO GAME", 7);
+            return -1;
+        }
+        found->attached = 1;
+        kref_get(&found->ref);
+        up_write(&t->lock);
+
+        detach_session(s);
+        rf->session = found;
+        output(found, "OK", 2);
+
+    /*Self-play command (06), "06 games [usecs [random]]\n" plays games bot
+      against bot on this session's board size, each bot move searching for
+      usecs and the first random moves of each game picked at random*/
+    } else if (s->kern_buf[1] == '6'){
+        struct self_play_result res;
+        char reply[sizeof(s->kern_buf)];
+        u32 args[3];
+        int check;
+        int len;
+        int n;
+
+        n = parse_args(s, 3, length, args, 3);
+        if (n <= 0 || args[0] == 0 || args[0] > SELF_PLAY_MAX_GAMES){
+            output(s, "INVFMT", 6);
+            return -1;
+        }
+        if (n < 2){
+            args[1] = READ_ONCE(bot_budget_us);
+        }
+        if (n < 3){
+            args[2] = 0;
+        }
+
+        /*The games are played on a session of their own, so this one and
+          its file are unlocked meanwhile and can be saved or watched. busy
+          turns other writes to the file away, keeping replies in order.*/
+        rf->busy = 1;
+        mutex_unlock(&s->mutex);
+        mutex_unlock(&rf->lock);
+        check = self_play(s->size, args[0], args[1], args[2], &res);
+        mutex_lock(&rf->lock);
+        mutex_lock(&s->mutex);
+        rf->busy = 0;
+        if (check != 0){
+            output(s, "ERROR", 5);
+            return -1;
+        }
+
+        len = scnprintf(reply, sizeof(reply),
+                        "OK %u X %u O %u T %u %llu games/s %llu moves/s %llu nodes/s",
+                        res.games, res.x_wins, res.o_wins, res.ties,
+                        self_play_rate(res.games, res.ns),
+                        self_play_rate(res.moves, res.ns),
+                        self_play_rate(res.nodes, res.ns));
+        output(s, reply, len);
+
+    /*Quota command (07), "07\n" returns this session's bot search time per
+      bot_period_ms in usecs and "07 usecs\n" sets it, 0 for no limit. Going
+      over bot_quota_us needs CAP_SYS_NICE, like raising a priority.*/
+    } else if (s->kern_buf[1] == '7'){
+        char quota_buf[12];
+        u32 quota;
+        u32 limit;
+        int len;
+
+        if (s->kern_buf[2] == '\n'){
+            len = snprintf(quota_buf, sizeof(quota_buf), "%u",
+                           session_quota_us(s));
+            output(s, quota_buf, len);
+            return 0;
+        }
+
+        if (parse_arg(s, 3, length, &quota) != 0){
+            output(s, "INVFMT", 6);
+            return -1;
+        }
+
+        limit = READ_ONCE(bot_quota_us);
+        if (limit != 0 && (quota == 0 || quota > limit) &&
+            !capable(CAP_SYS_NICE)){
+            output(s, "ERROR", 5);
+            return -1;
         }
+        s->quota_us = quota;
+        s->quota_set = 1;
+        output(s, "OK", 2);
+
+    } else {
+        output(s, "INVFMT", 6);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_arg(struct reversi_session *s, int off, int length, u32 *value){
+    if (parse_args(s, off, length, value, 1) != 1){
+        return -EINVAL;
     }
     return 0;
 }
 
-int check_adj_cells(int row, int col, char piece, int validate){
+static int parse_args(struct reversi_session *s, int off, int length,
+                      u32 *values, int max){
+    char num[12];
+    int check;
+    int end;
+    int n;
+
+    if (s->kern_buf[off-1] != ' ' || s->kern_buf[length-1] != '\n'){
+        return -EINVAL;
+    }
+
+    n = 0;
+    while (off < length){
+        end = off;
+        while (s->kern_buf[end] != ' ' && s->kern_buf[end] != '\n'){
+            end++;
+        }
+        if (n == max || end == off || end - off > 10){
+            return -EINVAL;
+        }
+
+        memcpy(num, &s->kern_buf[off], end - off);
+        num[end - off] = 0;
+        check = kstrtou32(num, 10, &values[n]);
+        if (check != 0){
+            return check;
+        }
+        n++;
+        off = end + 1;
+    }
+    return n;
+}
+
+static int board_size_ok(u32 size){
+    return size == 6 || size == 8 || size == 10;
+}
+
+int check_adj_cells(struct reversi_session *s, int row, int col, char piece, int validate){
     int val; /*Return value, 0 = no board change, 1 = board change*/
     int move; /*Var for checking if a move was made*/
     char opponent;
+    int last; /*Last row and col on this board*/
 
     val = 0;
+    last = s->size - 1;
     move = 0;
 
     opponent = 'X';
@@ -404,195 +3542,197 @@ int check_adj_cells(int row, int col, char piece, int validate){
     }
 
     if (row == 0 && col == 0){ /*Top left condition*/
-        if (gameboard[row][col+1] == opponent){ /*Right cell*/
-            move = check_and_flip(row,col, row, col+1, piece, validate);
+        if (s->gameboard[row][col+1] == opponent){ /*Right cell*/
+            move = check_and_flip(s, row,col, row, col+1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row+1][col] == opponent){ /*Bottom cell*/
-            move = check_and_flip(row, col, row+1, col, piece, validate);
+        if (s->gameboard[row+1][col] == opponent){ /*Bottom cell*/
+            move = check_and_flip(s, row, col, row+1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
-            move = check_and_flip(row,col, row+1, col+1, piece, validate);
+        if (s->gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
+            move = check_and_flip(s, row,col, row+1, col+1, piece, validate);
             if (move == 1){val = 1;}
         }
 
-    } else if (row == 0 && col == 7){ /*Top right condition*/
-        if (gameboard[row][col-1] == opponent){ /*Left cell*/
-            move = check_and_flip(row,col, row, col-1, piece, validate);
+    } else if (row == 0 && col == last){ /*Top right condition*/
+        if (s->gameboard[row][col-1] == opponent){ /*Left cell*/
+            move = check_and_flip(s, row,col, row, col-1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
-            move = check_and_flip(row,col, row+1, col-1, piece, validate);
+        if (s->gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
+            move = check_and_flip(s, row,col, row+1, col-1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row+1][col] == opponent){ /*Bottom cell*/
-            move = check_and_flip(row, col, row+1, col, piece, validate);
+        if (s->gameboard[row+1][col] == opponent){ /*Bottom cell*/
+            move = check_and_flip(s, row, col, row+1, col, piece, validate);
             if (move == 1){val = 1;}
         }
 
-    } else if (row == 0 && col != 0 && col != 7){ /*Top row condition*/
-        if (gameboard[row][col-1] == opponent){ /*Left cell*/
-            move = check_and_flip(row,col, row, col-1, piece, validate);
+    } else if (row == 0 && col != 0 && col != last){ /*Top row condition*/
+        if (s->gameboard[row][col-1] == opponent){ /*Left cell*/
+            move = check_and_flip(s, row,col, row, col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col+1] == opponent){ /*Right cell*/
-            move = check_and_flip(row,col, row, col+1, piece, validate);
+        if (s->gameboard[row][col+1] == opponent){ /*Right cell*/
+            move = check_and_flip(s, row,col, row, col+1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
-            move = check_and_flip(row,col, row+1, col-1, piece, validate);
+        if (s->gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
+            move = check_and_flip(s, row,col, row+1, col-1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row+1][col] == opponent){ /*Bottom cell*/
-            move = check_and_flip(row, col, row+1, col, piece, validate);
+        if (s->gameboard[row+1][col] == opponent){ /*Bottom cell*/
+            move = check_and_flip(s, row, col, row+1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
-            move = check_and_flip(row,col, row+1, col+1, piece, validate);
+        if (s->gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
+            move = check_and_flip(s, row,col, row+1, col+1, piece, validate);
             if (move == 1){val = 1;}
         }
 
-    } else if (row == 7 && col == 0){ /*Bottom left cell condition*/
-        if (gameboard[row-1][col] == opponent){ /*Top cell*/
-            move = check_and_flip(row, col, row-1, col, piece, validate);
+    } else if (row == last && col == 0){ /*Bottom left cell condition*/
+        if (s->gameboard[row-1][col] == opponent){ /*Top cell*/
+            move = check_and_flip(s, row, col, row-1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row-1][col+1] == opponent){ /*Top right cell*/
-            move = check_and_flip(row,col,row-1,col+1, piece, validate);
+        if (s->gameboard[row-1][col+1] == opponent){ /*Top right cell*/
+            move = check_and_flip(s, row,col,row-1,col+1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col+1] == opponent){ /*Right cell*/
-            move = check_and_flip(row,col, row, col+1, piece, validate);
+        if (s->gameboard[row][col+1] == opponent){ /*Right cell*/
+            move = check_and_flip(s, row,col, row, col+1, piece, validate);
             if (move == 1){val = 1;}
         } 
 
-    } else if (row == 7 && col == 7){ /*Bottom right cell condition*/
-        if (gameboard[row-1][col-1] == opponent){ /*Top left cell*/
-            move = check_and_flip(row,col,row-1,col-1, piece, validate);
+    } else if (row == last && col == last){ /*Bottom right cell condition*/
+        if (s->gameboard[row-1][col-1] == opponent){ /*Top left cell*/
+            move = check_and_flip(s, row,col,row-1,col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row-1][col] == opponent){ /*Top cell*/
-            move = check_and_flip(row, col, row-1, col, piece, validate);
+        if (s->gameboard[row-1][col] == opponent){ /*Top cell*/
+            move = check_and_flip(s, row, col, row-1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col-1] == opponent){ /*Left cell*/
-            move = check_and_flip(row,col, row, col-1, piece, validate);
+        if (s->gameboard[row][col-1] == opponent){ /*Left cell*/
+            move = check_and_flip(s, row,col, row, col-1, piece, validate);
             if (move == 1){val = 1;}
         } 
 
-    } else if (row == 7 && col != 0 && col != 7){ /*Bottom row condition*/
-        if (gameboard[row-1][col-1] == opponent){ /*Top left cell*/
-            move = check_and_flip(row,col,row-1,col-1, piece, validate);
+    } else if (row == last && col != 0 && col != last){ /*Bottom row condition*/
+        if (s->gameboard[row-1][col-1] == opponent){ /*Top left cell*/
+            move = check_and_flip(s, row,col,row-1,col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row-1][col] == opponent){ /*Top cell*/
-            move = check_and_flip(row, col, row-1, col, piece, validate);
+        if (s->gameboard[row-1][col] == opponent){ /*Top cell*/
+            move = check_and_flip(s, row, col, row-1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row-1][col+1] == opponent){ /*Top right cell*/
-            move = check_and_flip(row,col,row-1,col+1, piece, validate);
+        if (s->gameboard[row-1][col+1] == opponent){ /*Top right cell*/
+            move = check_and_flip(s, row,col,row-1,col+1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col-1] == opponent){ /*Left cell*/
-            move = check_and_flip(row,col, row, col-1, piece, validate);
+        if (s->gameboard[row][col-1] == opponent){ /*Left cell*/
+            move = check_and_flip(s, row,col, row, col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col+1] == opponent){ /*Right cell*/
-            move = check_and_flip(row,col, row, col+1, piece, validate);
+        if (s->gameboard[row][col+1] == opponent){ /*Right cell*/
+            move = check_and_flip(s, row,col, row, col+1, piece, validate);
             if (move == 1){val = 1;}
         } 
 
-    } else if (row != 0 && row != 7 && col == 0){ /*Left-most col condition*/
-        if (gameboard[row-1][col] == opponent){ /*Top cell*/
-            move = check_and_flip(row, col, row-1, col, piece, validate);
+    } else if (row != 0 && row != last && col == 0){ /*Left-most col condition*/
+        if (s->gameboard[row-1][col] == opponent){ /*Top cell*/
+            move = check_and_flip(s, row, col, row-1, col, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row-1][col+1] == opponent){ /*Top right cell*/
-            move = check_and_flip(row,col,row-1,col+1, piece, validate);
+        if (s->gameboard[row-1][col+1] == opponent){ /*Top right cell*/
+            move = check_and_flip(s, row,col,row-1,col+1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row][col+1] == opponent){ /*Right cell*/
-            move = check_and_flip(row,col, row, col+1, piece, validate);
+        if (s->gameboard[row][col+1] == opponent){ /*Right cell*/
+            move = check_and_flip(s, row,col, row, col+1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row+1][col] == opponent){ /*Bottom cell*/
-            move = check_and_flip(row, col, row+1, col, piece, validate);
+        if (s->gameboard[row+1][col] == opponent){ /*Bottom cell*/
+            move = check_and_flip(s, row, col, row+1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
-            move = check_and_flip(row,col, row+1, col+1, piece, validate); 
+        if (s->gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
+            move = check_and_flip(s, row,col, row+1, col+1, piece, validate); 
             if (move == 1){val = 1;}
         }
 
-    } else if (row != 0 && row != 7 && col == 7){ /*Right-most col condition*/
-        if (gameboard[row-1][col-1] == opponent){ /*Top left cell*/
-            move = check_and_flip(row,col,row-1,col-1, piece, validate);
+    } else if (row != 0 && row != last && col == last){ /*Right-most col condition*/
+        if (s->gameboard[row-1][col-1] == opponent){ /*Top left cell*/
+            move = check_and_flip(s, row,col,row-1,col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row-1][col] == opponent){ /*Top cell*/
-            move = check_and_flip(row, col, row-1, col, piece, validate);
+        if (s->gameboard[row-1][col] == opponent){ /*Top cell*/
+            move = check_and_flip(s, row, col, row-1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col-1] == opponent){ /*Left cell*/
-            move = check_and_flip(row,col, row, col-1, piece, validate);
+        if (s->gameboard[row][col-1] == opponent){ /*Left cell*/
+            move = check_and_flip(s, row,col, row, col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
-            move = check_and_flip(row,col, row+1, col-1, piece, validate);
+        if (s->gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
+            move = check_and_flip(s, row,col, row+1, col-1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row+1][col] == opponent){ /*Bottom cell*/
-            move = check_and_flip(row, col, row+1, col, piece, validate); 
+        if (s->gameboard[row+1][col] == opponent){ /*Bottom cell*/
+            move = check_and_flip(s, row, col, row+1, col, piece, validate); 
             if (move == 1){val = 1;}  
         }
 
     } else { /*Every other cell*/
-        if (gameboard[row-1][col-1] == opponent){ /*Top left cell*/
-            move = check_and_flip(row,col,row-1,col-1, piece, validate);
+        if (s->gameboard[row-1][col-1] == opponent){ /*Top left cell*/
+            move = check_and_flip(s, row,col,row-1,col-1, piece, validate);
             if (move == 1){val = 1;}
         }  
-        if (gameboard[row-1][col] == opponent){ /*Top cell*/
-            move = check_and_flip(row, col, row-1, col, piece, validate);
+        if (s->gameboard[row-1][col] == opponent){ /*Top cell*/
+            move = check_and_flip(s, row, col, row-1, col, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row-1][col+1] == opponent){ /*Top right cell*/
-            move = check_and_flip(row,col,row-1,col+1, piece, validate);
+        if (s->gameboard[row-1][col+1] == opponent){ /*Top right cell*/
+            move = check_and_flip(s, row,col,row-1,col+1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row][col-1] == opponent){ /*Left cell*/
-            move = check_and_flip(row,col, row, col-1, piece, validate);
+        if (s->gameboard[row][col-1] == opponent){ /*Left cell*/
+            move = check_and_flip(s, row,col, row, col-1, piece, validate);
             if (move == 1){val = 1;}
         }
-        if (gameboard[row][col+1] == opponent){ /*Right cell*/
-            move = check_and_flip(row,col, row, col+1, piece, validate);
+        if (s->gameboard[row][col+1] == opponent){ /*Right cell*/
+            move = check_and_flip(s, row,col, row, col+1, piece, validate);
             if (move == 1){val = 1;}
         }  
-        if (gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
-            move = check_and_flip(row,col, row+1, col-1, piece, validate);
+        if (s->gameboard[row+1][col-1] == opponent){ /*Bottom left cell*/
+            move = check_and_flip(s, row,col, row+1, col-1, piece, validate);
             if (move == 1){val = 1;}
         } 
-        if (gameboard[row+1][col] == opponent){ /*Bottom cell*/
-            move = check_and_flip(row, col, row+1, col, piece, validate);
+        if (s->gameboard[row+1][col] == opponent){ /*Bottom cell*/
+            move = check_and_flip(s, row, col, row+1, col, piece, validate);
             if (move == 1){val = 1;}
         }  
-        if (gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
-            move = check_and_flip(row,col, row+1, col+1, piece, validate);
+        if (s->gameboard[row+1][col+1] == opponent){ /*Bottom right cell*/
+            move = check_and_flip(s, row,col, row+1, col+1, piece, validate);
             if (move == 1){val = 1;}
         }
     }
     return val;
 }
 
-int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char piece, int validate){
+int check_and_flip(struct reversi_session *s, int empty_row, int empty_col, int opp_row, int opp_col, char piece, int validate){
     int return_val;
     char opponent;
     char check;
     int valid;
     int flag;
+    int last; /*Last row and col on this board*/
     int i;
 
     return_val = 0;
+    last = s->size - 1;
     opponent = 'X';
 
     if (piece == 'X'){
@@ -600,32 +3740,32 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
     }
 
     if (opp_row == empty_row - 1 && opp_col == empty_col - 1){ /*Moving up left*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
             if (opp_row - i < 0 || opp_col - i < 0){
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col-i] == '-'){
+            } else if (s->gameboard[opp_row-i][opp_col-i] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col-i] == piece){
+            } else if (s->gameboard[opp_row-i][opp_col-i] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col-i] == opponent){
+            } else if (s->gameboard[opp_row-i][opp_col-i] == opponent){
                 i+=1;
             }
         }
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row-i][empty_col-i] == piece){
+                    if (s->gameboard[empty_row-i][empty_col-i] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row-i][empty_col-i] = piece;
+                        s->gameboard[empty_row-i][empty_col-i] = piece;
                         i++;
                     }
                 }
@@ -637,33 +3777,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row - 1 && opp_col == empty_col + 1){ /*Moving up right*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
-            if (opp_row - i < 0 || opp_col + i > 7){
+            if (opp_row - i < 0 || opp_col + i > last){
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col+i] == '-'){
+            } else if (s->gameboard[opp_row-i][opp_col+i] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col+i] == piece){
+            } else if (s->gameboard[opp_row-i][opp_col+i] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col+i] == opponent){
+            } else if (s->gameboard[opp_row-i][opp_col+i] == opponent){
                 i+=1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row-i][empty_col+i] == piece){
+                    if (s->gameboard[empty_row-i][empty_col+i] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row-i][empty_col+i] = piece;
+                        s->gameboard[empty_row-i][empty_col+i] = piece;
                         i++;
                     }
                 }
@@ -675,33 +3815,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row - 1 && opp_col == empty_col){ /*Moving up*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
             if (opp_row - i < 0){
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col] == '-'){
+            } else if (s->gameboard[opp_row-i][opp_col] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col] == piece){
+            } else if (s->gameboard[opp_row-i][opp_col] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row-i][opp_col] == opponent){
+            } else if (s->gameboard[opp_row-i][opp_col] == opponent){
                 i += 1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row-i][empty_col] == piece){
+                    if (s->gameboard[empty_row-i][empty_col] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row-i][empty_col] = piece;
+                        s->gameboard[empty_row-i][empty_col] = piece;
                         i++;
                     }
                 }
@@ -713,33 +3853,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row && opp_col == empty_col - 1){ /*Moving left*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
             if (opp_col - i < 0){
                 flag = 1;
-            } else if (gameboard[opp_row][opp_col-i] == '-'){
+            } else if (s->gameboard[opp_row][opp_col-i] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row][opp_col-i] == piece){
+            } else if (s->gameboard[opp_row][opp_col-i] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row][opp_col-i] == opponent){
+            } else if (s->gameboard[opp_row][opp_col-i] == opponent){
                 i += 1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row][empty_col-i] == piece){
+                    if (s->gameboard[empty_row][empty_col-i] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row][empty_col-i] = piece;
+                        s->gameboard[empty_row][empty_col-i] = piece;
                         i++;
                     }
                 }
@@ -751,33 +3891,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row && opp_col == empty_col + 1){ /*Moving right*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
-            if (opp_col + i > 7){
+            if (opp_col + i > last){
                 flag = 1;
-            } else if (gameboard[opp_row][opp_col+i] == '-'){
+            } else if (s->gameboard[opp_row][opp_col+i] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row][opp_col+i] == piece){
+            } else if (s->gameboard[opp_row][opp_col+i] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row][opp_col+i] == opponent){
+            } else if (s->gameboard[opp_row][opp_col+i] == opponent){
                 i += 1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row][empty_col+i] == piece){
+                    if (s->gameboard[empty_row][empty_col+i] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row][empty_col+i] = piece;
+                        s->gameboard[empty_row][empty_col+i] = piece;
                         i++;
                     }
                 }
@@ -789,33 +3929,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row + 1 && opp_col == empty_col - 1){ /*Moving down left*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
-            if (opp_row + i > 7 || opp_col - i < 0){
+            if (opp_row + i > last || opp_col - i < 0){
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col-i] == '-'){
+            } else if (s->gameboard[opp_row+i][opp_col-i] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col-i] == piece){
+            } else if (s->gameboard[opp_row+i][opp_col-i] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col-i] == opponent){
+            } else if (s->gameboard[opp_row+i][opp_col-i] == opponent){
                 i+=1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row+i][empty_col-i] == piece){
+                    if (s->gameboard[empty_row+i][empty_col-i] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row+i][empty_col-i] = piece;
+                        s->gameboard[empty_row+i][empty_col-i] = piece;
                         i++;
                     }
                 }
@@ -827,33 +3967,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row + 1 && opp_col == empty_col){ /*Moving down*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
-            if (opp_row + i > 7){
+            if (opp_row + i > last){
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col] == '-'){
+            } else if (s->gameboard[opp_row+i][opp_col] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col] == piece){
+            } else if (s->gameboard[opp_row+i][opp_col] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col] == opponent){
+            } else if (s->gameboard[opp_row+i][opp_col] == opponent){
                 i += 1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row+i][empty_col] == piece){
+                    if (s->gameboard[empty_row+i][empty_col] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row+i][empty_col] = piece;
+                        s->gameboard[empty_row+i][empty_col] = piece;
                         i++;
                     }
                 }
@@ -865,33 +4005,33 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
             }
         }
     } else if (opp_row == empty_row + 1 && opp_col == empty_col + 1){ /*Moving down right*/
-        check = gameboard[opp_row][opp_col];
+        check = s->gameboard[opp_row][opp_col];
         valid = 0;
         flag = 0;
         i = 1;
         while (flag == 0){
-            if (opp_row + i > 7 || opp_col + i > 7){
+            if (opp_row + i > last || opp_col + i > last){
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col+i] == '-'){
+            } else if (s->gameboard[opp_row+i][opp_col+i] == '-'){
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col+i] == piece){
+            } else if (s->gameboard[opp_row+i][opp_col+i] == piece){
                 valid = 1;
                 flag = 1;
-            } else if (gameboard[opp_row+i][opp_col+i] == opponent){
+            } else if (s->gameboard[opp_row+i][opp_col+i] == opponent){
                 i+=1;
             }
         }
 
         if (validate == 0){
             if (valid == 1){ /*Move is valid, flip pieces*/
-                gameboard[empty_row][empty_col] = piece;
+                s->gameboard[empty_row][empty_col] = piece;
                 flag = 0;
                 i = 1;
                 while (flag == 0){
-                    if (gameboard[empty_row+i][empty_col+i] == piece){
+                    if (s->gameboard[empty_row+i][empty_col+i] == piece){
                         flag = 1;
                     } else {
-                        gameboard[empty_row+i][empty_col+i] = piece;
+                        s->gameboard[empty_row+i][empty_col+i] = piece;
                         i++;
                     }
                 }
@@ -906,12 +4046,12 @@ int check_and_flip(int empty_row, int empty_col, int opp_row, int opp_col, char
     return return_val;
 }
 
-int check_game_end(){
+int check_game_end(struct reversi_session *s){
     int check1;
     int check2;
 
-    check1 = check_for_valid_moves(player);
-    check2 = check_for_valid_moves(bot);
+    check1 = check_for_valid_moves(s, s->player);
+    check2 = check_for_valid_moves(s, s->bot);
 
     if (check1 == 1 || check2 == 1){
         return 0;
@@ -920,7 +4060,7 @@ int check_game_end(){
     return 1;
 }
 
-int count_pieces(){
+int count_pieces(struct reversi_session *s){
     int X;
     int O;
     int i;
@@ -928,50 +4068,52 @@ int count_pieces(){
     X = 0;
     O = 0;
 
-    for (i = 0; i < 8; i++){
-        for (j = 0; j < 8; j++){
-            if (gameboard[i][j] == 'X'){
+    for (i = 0; i < s->size; i++){
+        for (j = 0; j < s->size; j++){
+            if (s->gameboard[i][j] == 'X'){
                 X++;
-            } else if (gameboard[i][j] == 'O'){
+            } else if (s->gameboard[i][j] == 'O'){
                 O++;
             }
         }
     }
 
     if (X > O){
-        if (player == 'O'){
-            output("LOSE", 4);
-        } else if (bot == 'O'){
-            output("WIN", 3);
+        if (s->player == 'O'){
+            output(s, "LOSE", 4);
+        } else if (s->bot == 'O'){
+            output(s, "WIN", 3);
         }
     } else if (X < O){
-        if (player == 'X'){
-            output("LOSE", 4);
-        } else if (bot == 'O'){
-            output("WIN", 3);
+        if (s->player == 'X'){
+            output(s, "LOSE", 4);
+        } else if (s->bot == 'X'){
+            output(s, "WIN", 3);
         }
     } else if (X == O){
-        output("TIE", 3);
+        output(s, "TIE", 3);
     }
+
+    emit_game_record(s, X, O);
     return 0;
 }
 
-int check_for_valid_moves(char piece){
-    int i;
-    int j;
-    for (i = 0; i < 8; i++){
-        for (j = 0; j < 8; j++){
-            int check;
-            if (gameboard[i][j] == '-'){
-                check = check_adj_cells(i,j,piece,1);
-                if (check == 1){
-                    return 1;
-                }
-            }
-        }
+/*Runs on the bitboards for the session's size rather than calling
+  check_adj_cells on every empty square*/
+int check_for_valid_moves(struct reversi_session *s, char piece){
+    switch (s->size){
+    case 6:
+        return bb6_can_move(s, piece);
+    case 10:
+        return bb10_can_move(s, piece);
+    default:
+        return bb8_can_move(s, piece);
     }
-    return 0;
 }
 
 module_init(reversi_init);
-module_exit(reversi_exit);
\ No newline at end of file
+module_exit(reversi_exit);
+
+#if IS_ENABLED(CONFIG_REVERSI_KUNIT_TEST)
+#include "reversi_test.c"
+#endif
\ No newline at end of file
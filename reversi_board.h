@@ -0,0 +1,424 @@
+// SPDX-License-Identifier: GPL-2.0
+/*Bitboard rules and search for one board size. reversi.c includes this once
+  for each size with BOARD_N set, and everything here is named after it, so
+  bb8_moves is the 8x8 move generator and bb10_t the 10x10 board. Bit
+  row * BOARD_N + col is set for every piece, P is the side to move and O the
+  other side. The size is a constant everywhere below, so each geometry gets
+  its own unrolled code and the 8x8 search pays nothing for the others.*/
+
+#if BOARD_N * BOARD_N <= 64
+typedef u64 BB(t);
+#else
+typedef bb128 BB(t);
+#endif
+
+#if BOARD_N * BOARD_N == 64
+static const BB(t) BB(full) = ~(BB(t))0;
+#else
+static const BB(t) BB(full) = ((BB(t))1 << (BOARD_N * BOARD_N)) - 1;
+#endif
+
+/*Column 0 is one bit every BOARD_N, which is full / (2^BOARD_N - 1)*/
+static const BB(t) BB(not_col0) = BB(full) &
+    ~(BB(full) / (((BB(t))1 << BOARD_N) - 1));
+static const BB(t) BB(not_col_last) = BB(full) &
+    ~((BB(full) / (((BB(t))1 << BOARD_N) - 1)) << (BOARD_N - 1));
+
+static s8 BB(weights)[BOARD_N * BOARD_N];
+
+static inline BB(t) BB(bit)(int sq){
+    return (BB(t))1 << sq;
+}
+
+#if BOARD_N * BOARD_N <= 64
+static inline int BB(first)(BB(t) x){
+    return __ffs64(x);
+}
+
+static inline int BB(count)(BB(t) x){
+    return hweight64(x);
+}
+#else
+static inline int BB(first)(BB(t) x){
+    if ((u64)x != 0){
+        return __ffs64((u64)x);
+    }
+    return 64 + __ffs64((u64)(x >> 64));
+}
+
+static inline int BB(count)(BB(t) x){
+    return hweight64((u64)x) + hweight64((u64)(x >> 64));
+}
+#endif
+
+/*The 8 directions, with the mask that drops pieces wrapping from one edge of
+  the board to the other. dir is always a constant once the loops below are
+  unrolled, so the switch folds away.*/
+static __always_inline BB(t) BB(shift)(BB(t) x, int dir){
+    switch (dir){
+    case 0: /*Right*/
+        return (x << 1) & BB(not_col0);
+    case 1: /*Down left*/
+        return (x << (BOARD_N - 1)) & BB(not_col_last);
+    case 2: /*Down*/
+        return (x << BOARD_N) & BB(full);
+    case 3: /*Down right*/
+        return (x << (BOARD_N + 1)) & BB(not_col0);
+    case 4: /*Left*/
+        return (x >> 1) & BB(not_col_last);
+    case 5: /*Up right*/
+        return (x >> (BOARD_N - 1)) & BB(not_col0);
+    case 6: /*Up*/
+        return x >> BOARD_N;
+    default: /*Up left*/
+        return (x >> (BOARD_N + 1)) & BB(not_col_last);
+    }
+}
+
+/*Every square P can play*/
+static BB(t) BB(moves)(BB(t) P, BB(t) O){
+    BB(t) empty;
+    BB(t) moves;
+    BB(t) x;
+    int dir;
+    int i;
+
+    empty = BB(full) & ~(P | O);
+    moves = 0;
+    BB_UNROLL
+    for (dir = 0; dir < 8; dir++){
+        x = BB(shift)(P, dir) & O;
+        BB_UNROLL
+        for (i = 0; i < BOARD_N - 3; i++){
+            x |= BB(shift)(x, dir) & O;
+        }
+        moves |= BB(shift)(x, dir) & empty;
+    }
+    return moves;
+}
+
+#if defined(BB_SIMD) && BOARD_N * BOARD_N <= 64
+/*moves with AVX2, the caller holds the FPU. Each lane takes one direction
+  to the left and its opposite to the right. Instead of masking each shift,
+  O is cut down to the columns a run can cross without wrapping to the next
+  row. Not inlined, as a caller without AVX2 turned on could not take it.*/
+static BB_SIMD_TARGET noinline u64 BB(moves_simd)(u64 P, u64 O){
+    const u64 inner = BB(not_col0) & BB(not_col_last);
+    const bb_v4 shift = { 1, BOARD_N - 1, BOARD_N, BOARD_N + 1 };
+    const bb_v4 mask = { inner, inner, BB(full), inner };
+    bb_v4 p;
+    bb_v4 o;
+    bb_v4 l;
+    bb_v4 r;
+    int i;
+
+    p = (bb_v4){ P, P, P, P };
+    o = (bb_v4){ O, O, O, O } & mask;
+    l = (p << shift) & o;
+    r = (p >> shift) & o;
+    BB_UNROLL
+    for (i = 0; i < BOARD_N - 3; i++){
+        l |= (l << shift) & o;
+        r |= (r >> shift) & o;
+    }
+    l = (l << shift) | (r >> shift);
+    return (l[0] | l[1] | l[2] | l[3]) & BB(full) & ~(P | O);
+}
+#endif
+
+/*moves for a search, with AVX2 while the search holds the FPU*/
+static __always_inline BB(t) BB(search_moves)(struct search_ctx *ctx,
+                                              BB(t) P, BB(t) O){
+#if defined(BB_SIMD) && BOARD_N * BOARD_N <= 64
+    if (ctx->simd){
+        return BB(moves_simd)(P, O);
+    }
+#endif
+    return BB(moves)(P, O);
+}
+
+/*The pieces flipped by P playing sq*/
+static BB(t) BB(flips)(BB(t) P, BB(t) O, int sq){
+    BB(t) flips;
+    BB(t) line;
+    BB(t) x;
+    int dir;
+
+    flips = 0;
+    BB_UNROLL
+    for (dir = 0; dir < 8; dir++){
+        line = 0;
+        x = BB(shift)(BB(bit)(sq), dir);
+        while (x & O){
+            line |= x;
+            x = BB(shift)(x, dir);
+        }
+        if (x & P){
+            flips |= line;
+        }
+    }
+    return flips;
+}
+
+static void BB(build_weights)(void){
+    int row;
+    int col;
+    int a;
+    int b;
+
+    for (row = 0; row < BOARD_N; row++){
+        for (col = 0; col < BOARD_N; col++){
+            a = min(min(row, BOARD_N - 1 - row), 3);
+            b = min(min(col, BOARD_N - 1 - col), 3);
+            BB(weights)[row * BOARD_N + col] = corner_weights[a][b];
+        }
+    }
+}
+
+static int BB(eval)(BB(t) P, BB(t) O){
+    int score;
+    int sq;
+
+    score = 0;
+    while (P != 0){
+        sq = BB(first)(P);
+        score += BB(weights)[sq];
+        P &= P - 1;
+    }
+    while (O != 0){
+        sq = BB(first)(O);
+        score -= BB(weights)[sq];
+        O &= O - 1;
+    }
+    return score;
+}
+
+static void BB(pack)(struct reversi_session *s, BB(t) *x_mask, BB(t) *o_mask){
+    int i;
+    int j;
+
+    *x_mask = 0;
+    *o_mask = 0;
+    for (i = 0; i < BOARD_N; i++){
+        for (j = 0; j < BOARD_N; j++){
+            if (s->gameboard[i][j] == 'X'){
+                *x_mask |= BB(bit)(i * BOARD_N + j);
+            } else if (s->gameboard[i][j] == 'O'){
+                *o_mask |= BB(bit)(i * BOARD_N + j);
+            }
+        }
+    }
+}
+
+/*1 if piece has a move on the session's board*/
+static int BB(can_move)(struct reversi_session *s, char piece){
+    BB(t) x_mask;
+    BB(t) o_mask;
+
+    BB(pack)(s, &x_mask, &o_mask);
+    if (piece == 'X'){
+        return BB(moves)(x_mask, o_mask) != 0;
+    }
+    return BB(moves)(o_mask, x_mask) != 0;
+}
+
+static int BB(negamax)(struct search_ctx *ctx, BB(t) P, BB(t) O, int depth,
+                       int alpha, int beta, int passed){
+    BB(t) moves;
+    BB(t) flips;
+    int score;
+    int best;
+    int sq;
+
+    ctx->nodes++;
+    if ((ctx->nodes & (SEARCH_CHECK_NODES - 1)) == 0){
+        if (ktime_get_ns() >= ctx->deadline){
+            ctx->aborted = 1;
+        }
+        search_resched(ctx);
+    }
+    if (ctx->aborted){
+        return 0;
+    }
+
+    moves = BB(search_moves)(ctx, P, O);
+    if (moves == 0){
+        if (passed){ /*Neither side can move, the game is over*/
+            return (BB(count)(P) - BB(count)(O)) * SCORE_DISC;
+        }
+        return -BB(negamax)(ctx, O, P, depth, -beta, -alpha, 1);
+    }
+    if (depth == 0){
+        return BB(eval)(P, O) + 10 * (BB(count)(moves) -
+                                      BB(count)(BB(search_moves)(ctx, O, P)));
+    }
+
+    best = -SCORE_INF;
+    while (moves != 0){
+        sq = BB(first)(moves);
+        moves &= moves - 1;
+        flips = BB(flips)(P, O, sq);
+        score = -BB(negamax)(ctx, O & ~flips, P | flips | BB(bit)(sq),
+                             depth - 1, -beta, -alpha, 0);
+        if (score > best){
+            best = score;
+        }
+        if (best > alpha){
+            alpha = best;
+        }
+        if (alpha >= beta){
+            break;
+        }
+    }
+    return best;
+}
+
+/*Picks the bot's move, from the opening book or the endgame cache when the
+  board is 8x8 and the position is in one. Otherwise an iterative deepening
+  alpha-beta search runs until the job's deadline, a depth at a time if
+  search_yield sends the job back to the queue in between. The move kept is
+  the best one from the last depth searched in full, tried first at the
+  next depth. Until depth 1 completes it is the first square in row order
+  the bot can play. The worker's caller
+  holds the session's mutex, so the board cannot change underneath.*/
+static void BB(search)(struct search_job *job){
+    struct reversi_session *s;
+    struct search_ctx ctx;
+    BB(t) x_mask;
+    BB(t) o_mask;
+    BB(t) P;
+    BB(t) O;
+    BB(t) moves;
+    BB(t) rest;
+    BB(t) flips;
+    int empties;
+    int max_depth;
+    int depth;
+    int alpha;
+    int score;
+    int best_sq;
+    int iter_sq;
+    int sq;
+
+    s = job->s;
+    BB(pack)(s, &x_mask, &o_mask);
+    P = s->turn == 'X' ? x_mask : o_mask;
+    O = s->turn == 'X' ? o_mask : x_mask;
+
+    moves = BB(moves)(P, O);
+    empties = BOARD_N * BOARD_N - BB(count)(P | O);
+
+    if (job->yielded){
+        /*The last slice stopped after job->depth, carry on from there*/
+        job->yielded = 0;
+        best_sq = job->best_sq;
+    } else {
+        job->depth = 0;
+        job->nodes = 0;
+        if (moves == 0){
+            job->row = -1;
+            job->col = -1;
+            return;
+        }
+
+#if BOARD_N == 8
+        if (job->book){
+            sq = book_lookup(P, O);
+            if (sq >= 0 && (moves & BB(bit)(sq))){
+                job->row = sq / BOARD_N;
+                job->col = sq % BOARD_N;
+                return;
+            }
+        }
+
+        /*Solved before, by this session or another. Not with a fixed
+          depth, which has to play what its search finds.*/
+        if (job->fixed_depth == 0 &&
+            empties <= READ_ONCE(endgame_empties)){
+            sq = endgame_lookup(job->endgame, P, O);
+            if (sq >= 0 && (moves & BB(bit)(sq))){
+                job->depth = empties;
+                job->row = sq / BOARD_N;
+                job->col = sq % BOARD_N;
+                return;
+            }
+        }
+#endif
+        best_sq = BB(first)(moves);
+    }
+
+    ctx.deadline = job->search_deadline;
+    ctx.nodes = 0;
+    ctx.aborted = 0;
+#if BOARD_N * BOARD_N <= 64
+    search_fpu_begin(&ctx);
+#else
+    ctx.simd = 0;
+#endif
+
+    max_depth = empties;
+
+    /*A fixed depth gives the same move every time, whatever the load*/
+    if (job->fixed_depth != 0){
+        ctx.deadline = U64_MAX;
+        max_depth = min_t(int, max_depth, job->fixed_depth);
+    }
+
+    for (depth = job->depth + 1; depth <= max_depth; depth++){
+        alpha = -SCORE_INF;
+        iter_sq = -1;
+
+        /*Last depth's best move first, then the rest in row order*/
+        rest = moves & ~BB(bit)(best_sq);
+        sq = best_sq;
+        for (;;){
+            flips = BB(flips)(P, O, sq);
+            score = -BB(negamax)(&ctx, O & ~flips, P | flips | BB(bit)(sq),
+                                 depth - 1, -SCORE_INF, -alpha, 0);
+            if (ctx.aborted){
+                break;
+            }
+            if (score > alpha){
+                alpha = score;
+                iter_sq = sq;
+            }
+            if (rest == 0){
+                break;
+            }
+            sq = BB(first)(rest);
+            rest &= rest - 1;
+        }
+
+        if (ctx.aborted){
+            break;
+        }
+        best_sq = iter_sq;
+        job->depth = depth;
+
+        /*Slice between depths so other jobs and other work get the CPU*/
+        if (depth < max_depth && search_yield(job)){
+            job->yielded = 1;
+            break;
+        }
+        search_resched(&ctx);
+    }
+    search_fpu_end(&ctx);
+
+    job->nodes += ctx.nodes;
+    job->best_sq = best_sq;
+    if (job->yielded){
+        return;
+    }
+
+#if BOARD_N == 8
+    /*Searched to the end of the game, so alpha is the exact score*/
+    if (job->depth == empties){
+        endgame_store(job->endgame, P, O, alpha, best_sq);
+    }
+#endif
+
+    job->row = best_sq / BOARD_N;
+    job->col = best_sq % BOARD_N;
+}
+
+#undef BOARD_N
@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: GPL-2.0
+/*Replays a trace captured from /dev/reversi_trace against /dev/reversi.
+  Every file in the trace gets its own thread and its own open of the
+  device, and sends its commands in the order they were captured, either at
+  their original times or as fast as the device answers. Each reply is
+  checked byte for byte against the captured one, and the latency of every
+  command is reported next to the latency it had when it was captured.
+
+  Capture with the module loaded with trace_ring_kb set:
+      cat /dev/reversi_trace > trace.bin
+  For the bot's replies to match, capture and replay with the same fixed
+  bot_depth, since a search that runs by time picks moves by load. The
+  throughput in a 06 reply is never the same twice, so 06 is not checked.
+
+  Build with make replay.*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+
+/*Same layout as struct reversi_trace_event in reversi.c*/
+#define TRACE_COMMAND 1
+#define TRACE_REPLY   2
+
+struct trace_event {
+    uint16_t size;
+    uint8_t kind;
+    uint8_t pad;
+    uint32_t file;
+    uint32_t seq;
+    uint32_t session_id;
+    uint64_t ns;
+} __attribute__((packed));
+
+/*One command and the reply it got*/
+struct step {
+    uint64_t ns;           /*When the command was captured*/
+    uint64_t captured_ns;  /*Its latency then, 0 if the reply was lost*/
+    uint64_t replay_ns;    /*Its latency now*/
+    const char *cmd;
+    size_t cmd_len;
+    const char *reply;     /*NULL if the reply was lost*/
+    size_t reply_len;
+};
+
+/*The commands of one open of /dev/reversi*/
+struct stream {
+    pthread_t thread;
+    uint32_t file;
+    uint32_t session_id;   /*Session the file started on*/
+    int fd;                /*Its open of the device, -1 if that failed*/
+    struct step *steps;
+    int nsteps;
+    int gaps;              /*Events lost to a full ring*/
+};
+
+/*Captured session ids and the ones given out on replay, for 05*/
+struct id_map {
+    uint32_t captured;
+    uint32_t live;
+};
+
+#define CODES 9            /*00 to 07, and anything else*/
+#define SHOW_MISMATCHES 10
+
+static const char *device = "/dev/reversi";
+static int max_speed;
+static uint64_t base_ns;   /*First command in the trace*/
+static uint64_t start_ns;  /*When the replay started*/
+
+/*Filled in before any stream starts and only read after, so every 05
+  naming a session finds it however fast the other streams run*/
+static struct id_map *ids;
+static int nids;
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static long mismatches;
+static long unchecked;
+static long failed;
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns){
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR){
+    }
+}
+
+static int code_of(const char *cmd, size_t len){
+    if (len >= 2 && cmd[0] == '0' && cmd[1] >= '0' && cmd[1] <= '7'){
+        return cmd[1] - '0';
+    }
+    return CODES - 1;
+}
+
+static void map_id(uint32_t captured, uint32_t live){
+    ids = realloc(ids, (nids + 1) * sizeof(*ids));
+    if (ids == NULL){
+        perror("realloc");
+        exit(1);
+    }
+    ids[nids].captured = captured;
+    ids[nids].live = live;
+    nids++;
+}
+
+/*The live id for a captured one, or the id itself if it is not known*/
+static uint32_t live_id(uint32_t captured){
+    uint32_t live;
+    int i;
+
+    live = captured;
+    for (i = 0; i < nids; i++){
+        if (ids[i].captured == captured){
+            live = ids[i].live;
+            break;
+        }
+    }
+    return live;
+}
+
+/*Reads the number at the start of a captured payload, which has no NUL of
+  its own. Returns 1 if there was one.*/
+static int parse_id(const char *p, size_t len, uint32_t *id){
+    char num[16];
+
+    if (len >= sizeof(num)){
+        len = sizeof(num) - 1;
+    }
+    memcpy(num, p, len);
+    num[len] = 0;
+    return sscanf(num, "%u", id) == 1;
+}
+
+/*Sends one command and reads its reply into reply, returns the reply's
+  length or -1*/
+static ssize_t exchange(int fd, const char *cmd, size_t len, char *reply,
+                        size_t size){
+    ssize_t n;
+
+    if (write(fd, cmd, len) != (ssize_t)len){
+        return -1;
+    }
+    n = read(fd, reply, size);
+    return n;
+}
+
+static void report_mismatch(struct stream *st, int i, const char *want,
+                            size_t want_len, const char *got, ssize_t got_len){
+    pthread_mutex_lock(&report_lock);
+    mismatches++;
+    if (mismatches <= SHOW_MISMATCHES){
+        fprintf(stderr, "file %u command %d: %.*s", st->file, i,
+                (int)st->steps[i].cmd_len, st->steps[i].cmd);
+        fprintf(stderr, "  captured: %.*s", (int)want_len, want);
+        fprintf(stderr, "  replayed: %.*s", (int)got_len, got);
+    }
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void *replay_stream(void *arg){
+    struct stream *st;
+    struct step *step;
+    char reply[512];
+    char cmd[160];
+    char want[32];
+    const char *send;
+    const char *expect;
+    size_t send_len;
+    size_t expect_len;
+    uint64_t t0;
+    uint32_t id;
+    ssize_t n;
+    int fd;
+    int i;
+
+    st = arg;
+    fd = st->fd;
+    if (fd < 0){
+        pthread_mutex_lock(&report_lock);
+        failed += st->nsteps;
+        pthread_mutex_unlock(&report_lock);
+        return NULL;
+    }
+
+    for (i = 0; i < st->nsteps; i++){
+        step = &st->steps[i];
+        if (max_speed == 0){
+            sleep_until(start_ns + (step->ns - base_ns));
+        }
+
+        send = step->cmd;
+        send_len = step->cmd_len;
+        expect = step->reply;
+        expect_len = step->reply_len;
+
+        if (send_len > 3 && memcmp(send, "05 ", 3) == 0 &&
+            parse_id(send + 3, send_len - 3, &id) == 1){
+            send_len = snprintf(cmd, sizeof(cmd), "05 %u\n", live_id(id));
+            send = cmd;
+        } else if (send_len == 3 && memcmp(send, "05\n", 3) == 0 &&
+                   expect != NULL && parse_id(expect, expect_len, &id) == 1){
+            expect_len = snprintf(want, sizeof(want), "%u\n", live_id(id));
+            expect = want;
+        }
+
+        t0 = now_ns();
+        n = exchange(fd, send, send_len, reply, sizeof(reply));
+        step->replay_ns = now_ns() - t0;
+        if (n < 0){
+            pthread_mutex_lock(&report_lock);
+            failed++;
+            pthread_mutex_unlock(&report_lock);
+            continue;
+        }
+
+        if (expect == NULL || code_of(step->cmd, step->cmd_len) == 6){
+            pthread_mutex_lock(&report_lock);
+            unchecked++;
+            pthread_mutex_unlock(&report_lock);
+        } else if ((size_t)n != expect_len || memcmp(reply, expect, n) != 0){
+            report_mismatch(st, i, expect, expect_len, reply, n);
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b){
+    uint64_t x;
+    uint64_t y;
+
+    x = *(const uint64_t *)a;
+    y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_events(const void *a, const void *b){
+    const struct trace_event *x;
+    const struct trace_event *y;
+
+    x = *(const struct trace_event *const *)a;
+    y = *(const struct trace_event *const *)b;
+    if (le32toh(x->file) != le32toh(y->file)){
+        return le32toh(x->file) < le32toh(y->file) ? -1 : 1;
+    }
+    return le32toh(x->seq) < le32toh(y->seq) ? -1 : 1;
+}
+
+/*Microseconds at percentile p of a sorted list*/
+static double percentile(const uint64_t *v, long n, double p){
+    long i;
+
+    if (n == 0){
+        return 0;
+    }
+    i = (long)(p / 100 * (n - 1) + 0.5);
+    return v[i] / 1000.0;
+}
+
+static void print_row(const char *name, uint64_t *v, long n){
+    qsort(v, n, sizeof(*v), compare_u64);
+    printf("  %-9s %8ld %9.1f %9.1f %9.1f %9.1f %10.1f\n", name, n,
+           percentile(v, n, 50), percentile(v, n, 90), percentile(v, n, 99),
+           percentile(v, n, 99.9), n ? v[n-1] / 1000.0 : 0.0);
+}
+
+/*Latency by command, for the capture and for the replay*/
+static void report(struct stream *streams, int nstreams, long nsteps){
+    uint64_t *captured;
+    uint64_t *replayed;
+    char name[16];
+    long nc;
+    long nr;
+    int code;
+    int i;
+    int j;
+
+    captured = malloc(nsteps * sizeof(*captured));
+    replayed = malloc(nsteps * sizeof(*replayed));
+    if (captured == NULL || replayed == NULL){
+        perror("malloc");
+        exit(1);
+    }
+
+    printf("latency in usecs     count       p50       p90       p99     p99.9        max\n");
+    for (code = 0; code < CODES; code++){
+        nc = 0;
+        nr = 0;
+        for (i = 0; i < nstreams; i++){
+            for (j = 0; j < streams[i].nsteps; j++){
+                struct step *step = &streams[i].steps[j];
+
+                if (code_of(step->cmd, step->cmd_len) != code){
+                    continue;
+                }
+                if (step->reply != NULL){
+                    captured[nc++] = step->captured_ns;
+                }
+                replayed[nr++] = step->replay_ns;
+            }
+        }
+        if (nr == 0){
+            continue;
+        }
+        if (code == CODES - 1){
+            snprintf(name, sizeof(name), "other");
+        } else {
+            snprintf(name, sizeof(name), "0%d", code);
+        }
+        printf("%s\n", name);
+        print_row("captured", captured, nc);
+        print_row("replayed", replayed, nr);
+    }
+
+    free(captured);
+    free(replayed);
+}
+
+/*Reads the whole trace and splits it into one stream per file*/
+static struct stream *load_trace(const char *path, int *nstreams, long *nsteps){
+    struct trace_event **events;
+    struct trace_event *ev;
+    struct stream *streams;
+    struct stream *st;
+    struct step *step;
+    size_t size;
+    size_t cap;
+    size_t off;
+    size_t nev;
+    size_t i;
+    char *buf;
+    FILE *f;
+    size_t n;
+
+    f = fopen(path, "rb");
+    if (f == NULL){
+        perror(path);
+        exit(1);
+    }
+    cap = 1 << 20;
+    size = 0;
+    buf = malloc(cap);
+    while (buf != NULL && (n = fread(buf + size, 1, cap - size, f)) > 0){
+        size += n;
+        if (size == cap){
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+    }
+    fclose(f);
+    if (buf == NULL){
+        perror("malloc");
+        exit(1);
+    }
+
+    events = malloc((size / sizeof(*ev) + 1) * sizeof(*events));
+    if (events == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    nev = 0;
+    for (off = 0; off + sizeof(*ev) <= size; off += le16toh(ev->size)){
+        ev = (struct trace_event *)(buf + off);
+        if (le16toh(ev->size) < sizeof(*ev) || off + le16toh(ev->size) > size){
+            fprintf(stderr, "%s: bad event at byte %zu\n", path, off);
+            exit(1);
+        }
+        events[nev++] = ev;
+    }
+    qsort(events, nev, sizeof(*events), compare_events);
+
+    streams = calloc(nev + 1, sizeof(*streams));
+    if (streams == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    *nstreams = 0;
+    *nsteps = 0;
+    base_ns = UINT64_MAX;
+    st = NULL;
+
+    for (i = 0; i < nev; i++){
+        ev = events[i];
+        if (st == NULL || st->file != le32toh(ev->file)){
+            st = &streams[(*nstreams)++];
+            st->file = le32toh(ev->file);
+            st->session_id = le32toh(ev->session_id);
+        } else if (le32toh(ev->seq) != le32toh(events[i-1]->seq) + 1){
+            st->gaps++;
+        }
+
+        if (ev->kind == TRACE_COMMAND){
+            if ((st->nsteps & (st->nsteps - 1)) == 0){
+                st->steps = realloc(st->steps, (st->nsteps ? 2 * st->nsteps : 1) *
+                                               sizeof(*st->steps));
+                if (st->steps == NULL){
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            step = &st->steps[st->nsteps++];
+            memset(step, 0, sizeof(*step));
+            step->ns = le64toh(ev->ns);
+            step->cmd = (const char *)(ev + 1);
+            step->cmd_len = le16toh(ev->size) - sizeof(*ev);
+            if (step->ns < base_ns){
+                base_ns = step->ns;
+            }
+            (*nsteps)++;
+        } else if (ev->kind == TRACE_REPLY && st->nsteps > 0 && i > 0 &&
+                   events[i-1]->kind == TRACE_COMMAND &&
+                   le32toh(events[i-1]->file) == st->file &&
+                   le32toh(ev->seq) == le32toh(events[i-1]->seq) + 1){
+            step = &st->steps[st->nsteps - 1];
+            step->reply = (const char *)(ev + 1);
+            step->reply_len = le16toh(ev->size) - sizeof(*ev);
+            step->captured_ns = le64toh(ev->ns) - step->ns;
+        }
+    }
+
+    free(events);
+    return streams;
+}
+
+/*Opens the device for every stream and learns the id each open got, for
+  commands naming the captured one*/
+static void open_streams(struct stream *streams, int nstreams){
+    char reply[32];
+    uint32_t id;
+    ssize_t n;
+    int i;
+
+    for (i = 0; i < nstreams; i++){
+        streams[i].fd = open(device, O_RDWR);
+        if (streams[i].fd < 0){
+            perror(device);
+            continue;
+        }
+        n = exchange(streams[i].fd, "05\n", 3, reply, sizeof(reply));
+        if (n > 0 && parse_id(reply, n, &id) == 1){
+            map_id(streams[i].session_id, id);
+        }
+    }
+}
+
+static void usage(const char *prog){
+    fprintf(stderr, "usage: %s [-m] [-d device] trace\n"
+                    "  -m  replay as fast as the device answers instead of "
+                    "at the captured times\n"
+                    "  -d  device to replay against, %s by default\n",
+            prog, device);
+    exit(2);
+}
+
+int main(int argc, char **argv){
+    struct stream *streams;
+    uint64_t wall;
+    long nsteps;
+    int nstreams;
+    int gaps;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "md:")) != -1){
+        switch (opt){
+        case 'm':
+            max_speed = 1;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1){
+        usage(argv[0]);
+    }
+
+    streams = load_trace(argv[optind], &nstreams, &nsteps);
+    gaps = 0;
+    for (i = 0; i < nstreams; i++){
+        gaps += streams[i].gaps;
+    }
+
+    open_streams(streams, nstreams);
+    start_ns = now_ns();
+    for (i = 0; i < nstreams; i++){
+        if (pthread_create(&streams[i].thread, NULL, replay_stream,
+                           &streams[i]) != 0){
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for (i = 0; i < nstreams; i++){
+        pthread_join(streams[i].thread, NULL);
+    }
+    wall = now_ns() - start_ns;
+
+    printf("%ld commands from %d files in %.3f s, %.0f commands/s%s\n",
+           nsteps, nstreams, wall / 1e9, wall ? nsteps * 1e9 / wall : 0.0,
+           max_speed ? "" : " at captured times");
+    printf("%ld mismatched, %ld not checked, %ld failed, %d gaps in the trace\n",
+           mismatches, unchecked, failed, gaps);
+    report(streams, nstreams, nsteps);
+
+    return mismatches != 0 || failed != 0;
+}
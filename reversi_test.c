@@ -0,0 +1,1263 @@
+// SPDX-License-Identifier: GPL-2.0
+/*KUnit tests and microbenchmarks for the reversi engine. This file is
+  included at the end of reversi.c so it can reach the static functions.
+  Run it with
+      ./tools/testing/kunit/kunit.py run --kunitconfig=drivers/misc/reversi
+  after placing this directory at drivers/misc/reversi.*/
+
+#include <kunit/test.h>
+#include <linux/prandom.h>
+
+/*Boards are written as 8 rows of 8 characters, X, O or -*/
+static const char start_board[] =
+    "--------"
+    "--------"
+    "--------"
+    "---OX---"
+    "---XO---"
+    "--------"
+    "--------"
+    "--------";
+
+static void set_board(struct reversi_session *s, const char *board){
+    int i;
+
+    s->size = 8;
+    for (i = 0; i < 8; i++){
+        memcpy(s->gameboard[i], board + i * 8, 8);
+    }
+}
+
+static void expect_board(struct kunit *test, struct reversi_session *s,
+                         const char *board){
+    int i;
+
+    for (i = 0; i < 8; i++){
+        KUNIT_EXPECT_EQ(test, memcmp(s->gameboard[i], board + i * 8, 8), 0);
+    }
+}
+
+static struct reversi_session *test_session(struct kunit *test,
+                                            const char *board, char player){
+    struct reversi_session *s;
+
+    s = kunit_kzalloc(test, sizeof(*s), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, s);
+
+    kref_init(&s->ref);
+    mutex_init(&s->mutex);
+    set_board(s, board);
+    s->player = player;
+    s->bot = player == 'X' ? 'O' : 'X';
+    s->turn = 'X';
+    s->game_flag = 1;
+    return s;
+}
+
+static void clear_board(struct reversi_session *s){
+    memset(s->gameboard, '-', sizeof(s->gameboard));
+}
+
+static int on_board(int row, int col){
+    return row >= 0 && row < 8 && col >= 0 && col < 8;
+}
+
+/*X plays the start position's d3, flipping d4*/
+static void reversi_test_start_move(struct kunit *test){
+    struct reversi_session *s;
+
+    s = test_session(test, start_board, 'X');
+
+    KUNIT_EXPECT_EQ(test, check_adj_cells(s, 2, 3, 'X', 1), 1);
+    KUNIT_EXPECT_EQ(test, s->gameboard[2][3], '-'); /*Validating changes nothing*/
+    KUNIT_EXPECT_EQ(test, s->gameboard[3][3], 'O');
+
+    KUNIT_EXPECT_EQ(test, check_adj_cells(s, 2, 3, 'X', 0), 1);
+    KUNIT_EXPECT_EQ(test, s->gameboard[2][3], 'X');
+    KUNIT_EXPECT_EQ(test, s->gameboard[3][3], 'X');
+
+    /*Squares next to nothing to flip*/
+    KUNIT_EXPECT_EQ(test, check_adj_cells(s, 0, 0, 'O', 1), 0);
+    KUNIT_EXPECT_EQ(test, check_adj_cells(s, 2, 2, 'X', 1), 0);
+}
+
+/*Every square and every direction with room for a flank: an O next to the
+  square and an X behind it. This goes through each corner, edge and middle
+  branch of check_adj_cells and each direction of check_and_flip.*/
+static void reversi_test_every_flank(struct kunit *test){
+    struct reversi_session *s;
+    int row;
+    int col;
+    int dr;
+    int dc;
+
+    s = test_session(test, start_board, 'X');
+
+    for (row = 0; row < 8; row++){
+        for (col = 0; col < 8; col++){
+            for (dr = -1; dr <= 1; dr++){
+                for (dc = -1; dc <= 1; dc++){
+                    if ((dr == 0 && dc == 0) ||
+                        !on_board(row + dr, col + dc)){
+                        continue;
+                    }
+
+                    clear_board(s);
+                    s->gameboard[row+dr][col+dc] = 'O';
+
+                    if (!on_board(row + 2*dr, col + 2*dc)){
+                        /*The O is on the edge, nothing can be behind it*/
+                        KUNIT_EXPECT_EQ(test, check_adj_cells(s, row, col, 'X', 1), 0);
+                        continue;
+                    }
+
+                    KUNIT_EXPECT_EQ(test, check_adj_cells(s, row, col, 'X', 1), 0);
+
+                    s->gameboard[row+2*dr][col+2*dc] = 'X';
+                    KUNIT_EXPECT_EQ(test, check_adj_cells(s, row, col, 'X', 1), 1);
+                    KUNIT_EXPECT_EQ(test, s->gameboard[row+dr][col+dc], 'O');
+
+                    KUNIT_EXPECT_EQ(test, check_adj_cells(s, row, col, 'X', 0), 1);
+                    KUNIT_EXPECT_EQ(test, s->gameboard[row][col], 'X');
+                    KUNIT_EXPECT_EQ(test, s->gameboard[row+dr][col+dc], 'X');
+                }
+            }
+        }
+    }
+}
+
+/*A row of O running into the edge of the board cannot be flanked, for each
+  of the 8 directions out of d4*/
+static void reversi_test_flip_runs_off_board(struct kunit *test){
+    struct reversi_session *s;
+    int dr;
+    int dc;
+    int i;
+
+    s = test_session(test, start_board, 'X');
+
+    for (dr = -1; dr <= 1; dr++){
+        for (dc = -1; dc <= 1; dc++){
+            if (dr == 0 && dc == 0){
+                continue;
+            }
+            clear_board(s);
+            for (i = 1; on_board(3 + i*dr, 3 + i*dc); i++){
+                s->gameboard[3+i*dr][3+i*dc] = 'O';
+            }
+
+            KUNIT_EXPECT_EQ(test, check_and_flip(s, 3, 3, 3+dr, 3+dc, 'X', 1), 0);
+            KUNIT_EXPECT_EQ(test, check_and_flip(s, 3, 3, 3+dr, 3+dc, 'X', 0), 0);
+            KUNIT_EXPECT_EQ(test, s->gameboard[3][3], '-');
+        }
+    }
+}
+
+/*One move flanking in several directions flips every line, and only up to
+  the first X in each*/
+static void reversi_test_multi_flip(struct kunit *test){
+    struct reversi_session *s;
+    static const char board[] =
+        "X--X--X-"
+        "-O-O-O--"
+        "--OOO---"
+        "XOO-OOOX"
+        "--OOO---"
+        "-O-O-O--"
+        "X--X--X-"
+        "--------";
+
+    s = test_session(test, board, 'X');
+    KUNIT_EXPECT_EQ(test, check_adj_cells(s, 3, 3, 'X', 0), 1);
+    expect_board(test, s,
+        "X--X--X-"
+        "-X-X-X--"
+        "--XXX---"
+        "XXXXXXXX"
+        "--XXX---"
+        "-X-X-X--"
+        "X--X--X-"
+        "--------");
+}
+
+/*X has d3, c4, f5 and e6 at the start, and so does O on its own squares*/
+static void reversi_test_valid_moves_start(struct kunit *test){
+    struct reversi_session *s;
+
+    s = test_session(test, start_board, 'X');
+    KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'X'), 1);
+    KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'O'), 1);
+    KUNIT_EXPECT_EQ(test, check_game_end(s), 0);
+}
+
+/*X can take a1 but O has no move, so O has to pass and the game goes on*/
+static void reversi_test_pass(struct kunit *test){
+    struct reversi_session *s;
+    static const char board[] =
+        "-OXXXXXX"
+        "--------"
+        "--------"
+        "--------"
+        "--------"
+        "--------"
+        "--------"
+        "--------";
+
+    s = test_session(test, board, 'X');
+    KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'X'), 1);
+    KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'O'), 0);
+    KUNIT_EXPECT_EQ(test, check_game_end(s), 0);
+}
+
+/*The game ends on a full board and when neither side can move before that*/
+static void reversi_test_game_end(struct kunit *test){
+    struct reversi_session *s;
+
+    s = test_session(test, start_board, 'X');
+
+    memset(s->gameboard, 'X', sizeof(s->gameboard));
+    s->gameboard[7][7] = 'O';
+    KUNIT_EXPECT_EQ(test, check_game_end(s), 1);
+
+    /*Only X left and one empty square, nobody can flank anything*/
+    memset(s->gameboard, 'X', sizeof(s->gameboard));
+    s->gameboard[0][0] = '-';
+    KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'X'), 0);
+    KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'O'), 0);
+    KUNIT_EXPECT_EQ(test, check_game_end(s), 1);
+
+    /*One O in the corner lets X finish the game*/
+    s->gameboard[0][1] = 'O';
+    KUNIT_EXPECT_EQ(test, check_game_end(s), 0);
+}
+
+/*Fills the board with x_count X and the rest O*/
+static void fill_board(struct reversi_session *s, int x_count){
+    int i;
+
+    for (i = 0; i < 64; i++){
+        s->gameboard[i / 8][i % 8] = i < x_count ? 'X' : 'O';
+    }
+}
+
+static void expect_result(struct kunit *test, struct reversi_session *s,
+                          const char *result){
+    count_pieces(s);
+    KUNIT_EXPECT_STREQ(test, s->kern_buf, result);
+}
+
+/*The player wins or loses playing either colour, or ties*/
+static void reversi_test_count_pieces(struct kunit *test){
+    struct reversi_session *s;
+
+    s = test_session(test, start_board, 'X');
+    fill_board(s, 40);
+    expect_result(test, s, "WIN");
+    fill_board(s, 20);
+    expect_result(test, s, "LOSE");
+    fill_board(s, 32);
+    expect_result(test, s, "TIE");
+
+    s = test_session(test, start_board, 'O');
+    fill_board(s, 40);
+    expect_result(test, s, "LOSE");
+    fill_board(s, 20);
+    expect_result(test, s, "WIN");
+    fill_board(s, 32);
+    expect_result(test, s, "TIE");
+
+    /*Empty squares do not count for either side*/
+    fill_board(s, 40);
+    memset(s->gameboard[0], '-', 8);
+    memset(s->gameboard[1], '-', 8);
+    memset(s->gameboard[2], '-', 8);
+    expect_result(test, s, "WIN");
+}
+
+/*Plays a random move for the side to move in P, passing when it has none.
+  Returns 0 once neither side can move.*/
+static int random_move(struct rnd_state *rnd, u64 *P, u64 *O){
+    u64 moves;
+    u64 flips;
+    u64 t;
+    int n;
+    int sq;
+
+    moves = bb8_moves(*P, *O);
+    if (moves == 0){
+        if (bb8_moves(*O, *P) == 0){
+            return 0;
+        }
+        t = *P;
+        *P = *O;
+        *O = t;
+        return 1;
+    }
+
+    for (n = prandom_u32_state(rnd) % hweight64(moves); n > 0; n--){
+        moves &= moves - 1;
+    }
+    sq = __ffs64(moves);
+    flips = bb8_flips(*P, *O, sq);
+    t = *P | flips | (1ULL << sq);
+    *P = *O & ~flips;
+    *O = t;
+    return 1;
+}
+
+static void unpack_board(struct reversi_session *s, u64 x_mask, u64 o_mask){
+    int sq;
+
+    for (sq = 0; sq < 64; sq++){
+        if (x_mask & (1ULL << sq)){
+            s->gameboard[sq / 8][sq % 8] = 'X';
+        } else if (o_mask & (1ULL << sq)){
+            s->gameboard[sq / 8][sq % 8] = 'O';
+        } else {
+            s->gameboard[sq / 8][sq % 8] = '-';
+        }
+    }
+}
+
+/*The search's move generator agrees with check_adj_cells along random
+  games, and canonical gives every symmetric copy the same key*/
+static void reversi_test_bitboards_match(struct kunit *test){
+    struct reversi_session *s;
+    struct rnd_state rnd;
+    u64 P;
+    u64 O;
+    u64 moves;
+    u64 a;
+    u64 b;
+    u64 c;
+    u64 d;
+    int game;
+    int sq;
+    int sym;
+
+    s = test_session(test, start_board, 'X');
+    prandom_seed_state(&rnd, 421);
+
+    for (game = 0; game < 50; game++){
+        P = (1ULL << 28) | (1ULL << 35);
+        O = (1ULL << 27) | (1ULL << 36);
+        do {
+            unpack_board(s, P, O);
+            moves = 0;
+            for (sq = 0; sq < 64; sq++){
+                if (s->gameboard[sq / 8][sq % 8] == '-' &&
+                    check_adj_cells(s, sq / 8, sq % 8, 'X', 1) == 1){
+                    moves |= 1ULL << sq;
+                }
+            }
+            KUNIT_ASSERT_EQ(test, bb8_moves(P, O), moves);
+
+            a = P;
+            b = O;
+            canonical(&a, &b);
+            for (sym = 1; sym < 8; sym++){
+                c = sym_apply(P, sym);
+                d = sym_apply(O, sym);
+                KUNIT_EXPECT_EQ(test, sym_undo(c, sym), P);
+                canonical(&c, &d);
+                KUNIT_EXPECT_EQ(test, c, a);
+                KUNIT_EXPECT_EQ(test, d, b);
+            }
+        } while (random_move(&rnd, &P, &O));
+    }
+}
+
+/*Runs one command the way a write to the device does*/
+static void run_command(struct reversi_file *rf, const char *cmd){
+    strscpy(rf->session->kern_buf, cmd, sizeof(rf->session->kern_buf));
+    start(rf, strlen(cmd));
+}
+
+/*00 picks the board size and sets up the middle four squares, 01 prints
+  the whole board*/
+static void reversi_test_board_sizes(struct kunit *test){
+    static const char *const bad[] = {
+        "00 X 7\n", "00 X 12\n", "00 X 0\n", "00 X 10", "00 X  8\n",
+        "00 Xjunk\n", "00 X\tjunk\n", "00 XO\n",
+    };
+    struct reversi_session *s;
+    struct reversi_file rf;
+    int size;
+    int mid;
+    int i;
+
+    s = test_session(test, start_board, 'X');
+    rf.session = s;
+
+    run_command(&rf, "00 O\n");
+    KUNIT_EXPECT_STREQ(test, s->kern_buf, "OK");
+    KUNIT_EXPECT_EQ(test, s->size, 8);
+    run_command(&rf, "00 O");
+    KUNIT_EXPECT_STREQ(test, s->kern_buf, "OK");
+
+    for (size = 6; size <= 10; size += 2){
+        char cmd[16];
+
+        snprintf(cmd, sizeof(cmd), "00 X %d\n", size);
+        run_command(&rf, cmd);
+        KUNIT_EXPECT_STREQ(test, s->kern_buf, "OK");
+        KUNIT_ASSERT_EQ(test, s->size, size);
+
+        mid = size / 2;
+        KUNIT_EXPECT_EQ(test, s->gameboard[mid-1][mid-1], 'O');
+        KUNIT_EXPECT_EQ(test, s->gameboard[mid][mid-1], 'X');
+        KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, 'X'), 1);
+
+        run_command(&rf, "01\n");
+        KUNIT_EXPECT_EQ(test, s->kern_buf[size * size], '\t');
+        KUNIT_EXPECT_EQ(test, s->kern_buf[size * size + 1], 'X');
+        KUNIT_EXPECT_EQ(test, s->kern_buf[size * size + 2], '\n');
+        KUNIT_EXPECT_EQ(test, s->kern_buf[mid * size + mid], 'O');
+
+        /*The far corner is on the board and one past it is not*/
+        snprintf(cmd, sizeof(cmd), "02 %d %d\n", size - 1, size - 1);
+        run_command(&rf, cmd);
+        KUNIT_EXPECT_STREQ(test, s->kern_buf, "ILLMOVE");
+    }
+
+    for (i = 0; i < ARRAY_SIZE(bad); i++){
+        run_command(&rf, bad[i]);
+        KUNIT_EXPECT_STREQ(test, s->kern_buf, "INVFMT");
+        KUNIT_EXPECT_EQ(test, s->size, 10);
+    }
+}
+
+/*Takes every queued reply off rf as one string*/
+static char *take_replies(struct kunit *test, struct reversi_file *rf){
+    size_t n;
+    char *out;
+
+    n = rf->reply_tail - rf->reply_head;
+    out = kunit_kzalloc(test, n + 1, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+    memcpy(out, rf->replies + rf->reply_head, n);
+    rf->reply_head = rf->reply_tail;
+    return out;
+}
+
+/*One write carrying several commands gets one reply line for each, in
+  order, and a blank line gets none*/
+static void reversi_test_batch(struct kunit *test){
+    static const char batch[] = "00 X\n02 3 2\n\n01\n02 9 9\n08\n00 O";
+    static const char four[] = "01\n01\n01\n01\n";
+    struct reversi_session *s;
+    struct reversi_file rf = {};
+    char line[202];
+    char *reply;
+
+    s = test_session(test, start_board, 'X');
+    rf.session = s;
+    rf.reply_kb = 64;
+
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, batch, strlen(batch), 0),
+                    (ssize_t)strlen(batch));
+    KUNIT_EXPECT_STREQ(test, take_replies(test, &rf),
+                       "OK\nOK\n"
+                       "--------"
+                       "--------"
+                       "---X----"
+                       "---XX---"
+                       "---XO---"
+                       "--------"
+                       "--------"
+                       "--------\tO\n"
+                       "OOT\nINVFMT\nOK\n");
+    KUNIT_EXPECT_EQ(test, s->player, 'O');
+
+    /*A last line with no newline waits for the rest when more is coming*/
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, "05\n05", 5, 1), 3);
+    KUNIT_EXPECT_EQ(test, take_replies(test, &rf)[0], '0');
+
+    /*A last 00 with no newline after a long reply only sees its own bytes*/
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, "03 1000\n00 X", 12, 0), 12);
+    reply = take_replies(test, &rf);
+    KUNIT_EXPECT_EQ(test, strncmp(reply, "OK ", 3), 0);
+    KUNIT_EXPECT_STREQ(test, strchr(reply, '\n'), "\nOK\n");
+    KUNIT_EXPECT_EQ(test, s->player, 'X');
+
+    /*A line too long to be any command*/
+    memset(line, 'a', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, line, sizeof(line), 0),
+                    (ssize_t)sizeof(line));
+    KUNIT_EXPECT_STREQ(test, take_replies(test, &rf), "INVFMT\n");
+
+    /*The smallest queue holds two boards, the write stops after them*/
+    rf.reply_kb = 0;
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, four, strlen(four), 0), 6);
+    KUNIT_EXPECT_EQ(test, rf.reply_tail - rf.reply_head, 2 * 67);
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, four + 6, strlen(four) - 6, 0),
+                    -EAGAIN);
+    take_replies(test, &rf);
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, four + 6, strlen(four) - 6, 0), 6);
+
+    kfree(rf.replies);
+}
+
+/*06 plays its games away from the caller's board and every game gets a
+  result*/
+static void reversi_test_self_play(struct kunit *test){
+    struct reversi_session *s;
+    struct reversi_file rf;
+    u32 games;
+    u32 x;
+    u32 o;
+    u32 t;
+    int check;
+
+    s = test_session(test, start_board, 'X');
+    rf.session = s;
+    rf.busy = 0;
+    mutex_init(&rf.lock);
+
+    /*06 drops the locks run_commands holds while the games run*/
+    mutex_lock(&rf.lock);
+    mutex_lock(&s->mutex);
+    run_command(&rf, "06 4 200 6\n");
+    KUNIT_EXPECT_EQ(test, rf.busy, 0);
+    mutex_unlock(&s->mutex);
+    mutex_unlock(&rf.lock);
+    check = sscanf(s->kern_buf, "OK %u X %u O %u T %u", &games, &x, &o, &t);
+    KUNIT_ASSERT_EQ(test, check, 4);
+    KUNIT_EXPECT_EQ(test, games, 4);
+    KUNIT_EXPECT_EQ(test, x + o + t, 4);
+    expect_board(test, s, start_board);
+    KUNIT_EXPECT_EQ(test, s->game_flag, 1);
+
+    run_command(&rf, "06 0\n");
+    KUNIT_EXPECT_STREQ(test, s->kern_buf, "INVFMT");
+    run_command(&rf, "06 1 2 3 4\n");
+    KUNIT_EXPECT_STREQ(test, s->kern_buf, "INVFMT");
+}
+
+/*A spectator starts from the whole board, then gets one delta per change
+  and the board again once it falls a ring behind*/
+static void reversi_test_watch(struct kunit *test){
+    struct reversi_watch_delta d[WATCH_BATCH];
+    struct reversi_spectator sp = {};
+    struct reversi_session *s;
+    struct reversi_file rf;
+    bb128 x_mask;
+    bb128 o_mask;
+    int i;
+
+    s = test_session(test, start_board, 'X');
+    rf.session = s;
+    pack_board(s, &x_mask, &o_mask);
+
+    KUNIT_ASSERT_EQ(test, watch_attach(&sp, s), 0);
+    KUNIT_EXPECT_EQ(test, watch_collect(&sp, d, WATCH_BATCH), 2);
+    KUNIT_EXPECT_EQ(test, d[0].kind, WATCH_BOARD);
+    KUNIT_EXPECT_EQ(test, d[0].piece, 'X');
+    KUNIT_EXPECT_EQ(test, le64_to_cpu(d[0].mask), (u64)x_mask);
+    KUNIT_EXPECT_EQ(test, d[1].piece, 'O');
+    KUNIT_EXPECT_EQ(test, le64_to_cpu(d[1].mask), (u64)o_mask);
+    KUNIT_EXPECT_EQ(test, le32_to_cpu(d[1].seq), 0);
+    KUNIT_EXPECT_FALSE(test, watch_available(&sp));
+
+    run_command(&rf, "02 3 2\n");
+    run_command(&rf, "04\n"); /*The bot has moves, nothing changes*/
+    KUNIT_EXPECT_EQ(test, watch_collect(&sp, d, WATCH_BATCH), 1);
+    KUNIT_EXPECT_EQ(test, le32_to_cpu(d[0].seq), 1);
+    KUNIT_EXPECT_EQ(test, d[0].kind, WATCH_MOVE);
+    KUNIT_EXPECT_EQ(test, d[0].piece, 'X');
+    KUNIT_EXPECT_EQ(test, d[0].square, 2 * 8 + 3);
+    KUNIT_EXPECT_EQ(test, le64_to_cpu(d[0].mask), 1ULL << (3 * 8 + 3));
+
+    s->turn = 'O';
+    log_move(s, MOVE_PASS);
+    run_command(&rf, "00 O 6\n");
+    KUNIT_EXPECT_EQ(test, watch_collect(&sp, d, WATCH_BATCH), 3);
+    KUNIT_EXPECT_EQ(test, d[0].kind, WATCH_PASS);
+    KUNIT_EXPECT_EQ(test, d[0].piece, 'O');
+    KUNIT_EXPECT_EQ(test, d[1].kind, WATCH_BOARD);
+    KUNIT_EXPECT_EQ(test, d[1].size, 6);
+    KUNIT_EXPECT_EQ(test, le32_to_cpu(d[2].seq), 3);
+
+    for (i = 0; i < WATCH_RING + 1; i++){
+        log_move(s, MOVE_PASS);
+    }
+    /*A spectator that fell behind gets the board kept with the ring, the
+      session's mutex held meanwhile does not stop it*/
+    pack_board(s, &x_mask, &o_mask);
+    mutex_lock(&s->mutex);
+    KUNIT_EXPECT_EQ(test, watch_collect(&sp, d, WATCH_BATCH), 2);
+    mutex_unlock(&s->mutex);
+    KUNIT_EXPECT_EQ(test, d[0].kind, WATCH_BOARD);
+    KUNIT_EXPECT_EQ(test, d[0].size, 6);
+    KUNIT_EXPECT_EQ(test, le64_to_cpu(d[0].mask), (u64)x_mask);
+    KUNIT_EXPECT_EQ(test, le64_to_cpu(d[1].mask), (u64)o_mask);
+    KUNIT_EXPECT_EQ(test, le32_to_cpu(d[0].seq), 3 + WATCH_RING + 1);
+    KUNIT_EXPECT_FALSE(test, watch_available(&sp));
+
+    watch_detach(&sp);
+    KUNIT_EXPECT_EQ(test, s->watch->watchers, 0);
+    /*As free_session does, the moves above queued the wake work*/
+    cancel_work_sync(&s->watch->wake);
+    kfree(s->watch);
+}
+
+/*Moves every trace event out of the rings into buf, returns the bytes*/
+static size_t take_trace(struct record_ring __percpu *rings, u8 *buf,
+                         size_t max){
+    struct record_ring *ring;
+    size_t done;
+    size_t size;
+    int cpu;
+
+    done = 0;
+    for_each_possible_cpu(cpu){
+        ring = per_cpu_ptr(rings, cpu);
+        while (ring->tail != ring->head){
+            size = ring->buf[ring->tail & (ring->size - 1)] |
+                   ring->buf[(ring->tail + 1) & (ring->size - 1)] << 8;
+            if (done + size <= max){
+                memcpy(buf + done, ring->buf + (ring->tail & (ring->size - 1)),
+                       size);
+                done += size;
+            }
+            ring->tail += size;
+        }
+    }
+    return done;
+}
+
+/*Each command and its reply come out of the trace in order for the file,
+  and a fixed bot_depth gives the same bot move every time*/
+static void reversi_test_trace(struct kunit *test){
+    static const char cmds[] = "01\n02 9 9\n03 1\n";
+    static const char *const data[] = {
+        "01\n", NULL, "02 9 9\n", "ILLMOVE\n", "03 1\n", "OOT\n",
+    };
+    struct reversi_trace_event *ev[ARRAY_SIZE(data)];
+    struct reversi_trace_event *e;
+    struct record_ring __percpu *rings;
+    struct reversi_session *s;
+    struct reversi_file rf = {};
+    struct search_job job[2] = {};
+    size_t len;
+    size_t off;
+    u8 *buf;
+    int check;
+    int i;
+
+    buf = kunit_kzalloc(test, 4096, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, buf);
+
+    /*Rings of the test's own, so a capture running meanwhile is left
+      alone*/
+    rings = alloc_percpu(struct record_ring);
+    KUNIT_ASSERT_NOT_NULL(test, rings);
+    check = alloc_rings(rings, 4, 256);
+    if (check != 0){
+        free_percpu(rings);
+    }
+    KUNIT_ASSERT_EQ(test, check, 0);
+
+    s = test_session(test, start_board, 'X');
+    s->id = 42;
+    rf.session = s;
+    rf.id = 7;
+    rf.trace = rings;
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, cmds, strlen(cmds), 0),
+                    (ssize_t)strlen(cmds));
+    len = take_trace(rings, buf, 4096);
+
+    memset(ev, 0, sizeof(ev));
+    for (off = 0; off < len; off += le16_to_cpu(e->size)){
+        e = (struct reversi_trace_event *)(buf + off);
+        KUNIT_ASSERT_TRUE(test, le32_to_cpu(e->seq) < ARRAY_SIZE(ev));
+        ev[le32_to_cpu(e->seq)] = e;
+    }
+    for (i = 0; i < ARRAY_SIZE(ev); i++){
+        e = ev[i];
+        KUNIT_ASSERT_NOT_NULL(test, e);
+        KUNIT_EXPECT_EQ(test, e->kind, i % 2 ? TRACE_REPLY : TRACE_COMMAND);
+        KUNIT_EXPECT_EQ(test, le32_to_cpu(e->file), 7);
+        KUNIT_EXPECT_EQ(test, le32_to_cpu(e->session_id), 42);
+        if (i > 0){
+            KUNIT_EXPECT_GE(test, le64_to_cpu(e->ns), le64_to_cpu(ev[i-1]->ns));
+        }
+        if (data[i] != NULL){
+            KUNIT_EXPECT_EQ(test, le16_to_cpu(e->size),
+                            sizeof(*e) + strlen(data[i]));
+            KUNIT_EXPECT_MEMEQ(test, e + 1, data[i], strlen(data[i]));
+        }
+    }
+    KUNIT_EXPECT_EQ(test, le16_to_cpu(ev[1]->size), sizeof(*e) + 67);
+
+    /*Nothing is traced for a file opened with tracing off*/
+    rf.trace = NULL;
+    run_commands(&rf, cmds, strlen(cmds), 0);
+    KUNIT_EXPECT_EQ(test, take_trace(rings, buf, 4096), 0);
+
+    free_rings(rings);
+    free_percpu(rings);
+
+    for (i = 0; i < 2; i++){
+        set_board(s, start_board);
+        s->turn = s->bot;
+        job[i].s = s;
+        job[i].search_deadline = U64_MAX;
+        job[i].fixed_depth = 3;
+        bb8_search(&job[i]);
+    }
+    KUNIT_EXPECT_EQ(test, job[0].depth, 3);
+    KUNIT_EXPECT_EQ(test, job[1].depth, 3);
+    KUNIT_EXPECT_EQ(test, job[0].nodes, job[1].nodes);
+    KUNIT_EXPECT_EQ(test, job[0].row, job[1].row);
+    KUNIT_EXPECT_EQ(test, job[0].col, job[1].col);
+
+    kfree(rf.replies);
+}
+
+/*Plays random games until one reaches a position with empties empty
+  squares that P can move from*/
+static void endgame_position(struct rnd_state *rnd, int empties, u64 *P, u64 *O){
+    for (;;){
+        *P = (1ULL << 28) | (1ULL << 35);
+        *O = (1ULL << 27) | (1ULL << 36);
+        while (64 - hweight64(*P | *O) > empties && random_move(rnd, P, O)){
+        }
+        if (64 - hweight64(*P | *O) == empties && bb8_moves(*P, *O) != 0){
+            return;
+        }
+    }
+}
+
+/*An endgame solved once is played again from the cache, in any symmetry,
+  and a full set gives way with CLOCK*/
+static void reversi_test_endgame_cache(struct kunit *test){
+    struct endgame_cache *cache;
+    struct endgame_stats before;
+    struct endgame_stats after;
+    struct reversi_session *s;
+    struct search_job job = {};
+    struct rnd_state rnd;
+    u64 P;
+    u64 O;
+    u64 x;
+    u64 o;
+    int row;
+    int col;
+    int i;
+
+    /*A small table of the test's own, so searches running meanwhile keep
+      the real one*/
+    cache = alloc_endgame_cache(0);
+    KUNIT_ASSERT_NOT_NULL(test, cache);
+
+    prandom_seed_state(&rnd, 38);
+    endgame_position(&rnd, 8, &P, &O);
+    s = test_session(test, start_board, 'O');
+    unpack_board(s, P, O);
+    job.s = s;
+    job.search_deadline = U64_MAX;
+    job.endgame = cache;
+
+    endgame_stats_sum(cache, &before);
+    bb8_search(&job);
+    endgame_stats_sum(cache, &after);
+    KUNIT_EXPECT_EQ(test, job.depth, 8);
+    KUNIT_EXPECT_GT(test, job.nodes, 0);
+    KUNIT_EXPECT_EQ(test, after.misses - before.misses, 1);
+    KUNIT_EXPECT_EQ(test, after.hits, before.hits);
+    row = job.row;
+    col = job.col;
+
+    /*The same position transposed*/
+    unpack_board(s, bb_transpose(P), bb_transpose(O));
+    bb8_search(&job);
+    endgame_stats_sum(cache, &before);
+    KUNIT_EXPECT_EQ(test, before.hits - after.hits, 1);
+    KUNIT_EXPECT_EQ(test, job.nodes, 0);
+    KUNIT_EXPECT_EQ(test, job.row, col);
+    KUNIT_EXPECT_EQ(test, job.col, row);
+    KUNIT_EXPECT_EQ(test, check_adj_cells(s, job.row, job.col, 'X', 0), 1);
+
+    /*Four times as many positions as entries. The first is looked up all
+      along, so CLOCK keeps it while the others are pushed out.*/
+    for (i = 0; i < 4 * ENDGAME_STRIPES * ENDGAME_WAYS; i++){
+        x = ((u64)prandom_u32_state(&rnd) << 32) | prandom_u32_state(&rnd);
+        o = ((u64)prandom_u32_state(&rnd) << 32) | prandom_u32_state(&rnd);
+        endgame_store(cache, x & ~o, o, 0, __ffs64(~(x | o)));
+        KUNIT_EXPECT_EQ(test, endgame_lookup(cache, P, O), row * 8 + col);
+    }
+    endgame_stats_sum(cache, &after);
+    KUNIT_EXPECT_GE(test, after.evictions - before.evictions,
+                    3 * ENDGAME_STRIPES * ENDGAME_WAYS);
+
+    free_endgame_cache(cache);
+}
+
+/*Sessions take their ids from their own node's table, and a worker only
+  steals jobs queued on other nodes*/
+static void reversi_test_numa(struct kunit *test){
+    struct reversi_session *s;
+    struct search_job job = {};
+    struct search_node **nodes;
+    struct search_node *sn;
+    int node;
+    int other;
+    int i;
+
+    for (i = 0; i < 2; i++){
+        node = (numa_node_id() + i) % nr_node_ids;
+        s = alloc_session(node);
+        KUNIT_ASSERT_NOT_NULL(test, s);
+        kref_get(&s->ref);
+        KUNIT_ASSERT_EQ(test, session_add(s), 0);
+        KUNIT_EXPECT_EQ(test, s->id % nr_node_ids, node);
+        KUNIT_EXPECT_TRUE(test, xa_load(&session_table(s->id)->sessions,
+                                        s->id / nr_node_ids) == s);
+
+        detach_session(s);
+        KUNIT_EXPECT_TRUE(test, xa_load(&session_table(s->id)->sessions,
+                                        s->id / nr_node_ids) == NULL);
+        session_put(s);
+    }
+
+    nodes = kunit_kcalloc(test, nr_node_ids, sizeof(*nodes), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, nodes);
+    for (i = 0; i < nr_node_ids; i++){
+        nodes[i] = kunit_kzalloc(test, sizeof(**nodes), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, nodes[i]);
+        spin_lock_init(&nodes[i]->lock);
+        nodes[i]->queue = RB_ROOT_CACHED;
+    }
+
+    node = numa_node_id();
+    other = (node + 1) % nr_node_ids;
+    sn = nodes[other];
+    spin_lock(&sn->lock);
+    search_insert(sn, &job);
+    spin_unlock(&sn->lock);
+
+    KUNIT_EXPECT_TRUE(test, search_steal(nodes, other) == NULL);
+    if (other != node){
+        KUNIT_EXPECT_TRUE(test, search_steal(nodes, node) == &job);
+    } else {
+        spin_lock(&sn->lock);
+        KUNIT_EXPECT_TRUE(test, search_pop(sn) == &job);
+        spin_unlock(&sn->lock);
+    }
+    KUNIT_EXPECT_EQ(test, sn->queued, 0);
+}
+
+/*A search gives way between depths to a job due before it, then picks up
+  at the next depth and plays what it would have played in one go*/
+static void reversi_test_search_yield(struct kunit *test){
+    struct reversi_session *s;
+    struct search_job other = {};
+    struct search_job job = {};
+    struct search_node sn = {};
+    int row;
+    int col;
+
+    s = test_session(test, start_board, 'O');
+
+    job.s = s;
+    job.search_deadline = U64_MAX;
+    job.fixed_depth = 4;
+    bb8_search(&job);
+    KUNIT_EXPECT_EQ(test, job.depth, 4);
+    row = job.row;
+    col = job.col;
+
+    spin_lock_init(&sn.lock);
+    sn.queue = RB_ROOT_CACHED;
+    spin_lock(&sn.lock);
+    search_insert(&sn, &other);
+    spin_unlock(&sn.lock);
+
+    memset(&job, 0, sizeof(job));
+    job.s = s;
+    job.search_deadline = U64_MAX;
+    job.fixed_depth = 4;
+    job.deadline = 1;
+    job.worker = &sn;
+    bb8_search(&job);
+    KUNIT_EXPECT_EQ(test, job.yielded, 1);
+    KUNIT_EXPECT_EQ(test, job.depth, 1);
+    KUNIT_EXPECT_GT(test, job.deadline, 1);
+
+    spin_lock(&sn.lock);
+    KUNIT_EXPECT_TRUE(test, search_pop(&sn) == &other);
+    spin_unlock(&sn.lock);
+    bb8_search(&job);
+    KUNIT_EXPECT_EQ(test, job.yielded, 0);
+    KUNIT_EXPECT_EQ(test, job.depth, 4);
+    KUNIT_EXPECT_EQ(test, job.row, row);
+    KUNIT_EXPECT_EQ(test, job.col, col);
+}
+
+/*07 sets a session's own search quota, which its bot moves are held to
+  in place of bot_quota_us*/
+static void reversi_test_quota(struct kunit *test){
+    static const char cmds[] = "07 1000\n07\n07 x\n";
+    struct reversi_session *s;
+    struct reversi_file rf = {};
+    struct search_job job;
+
+    s = test_session(test, start_board, 'X');
+    rf.session = s;
+    KUNIT_EXPECT_EQ(test, session_quota_us(s), READ_ONCE(bot_quota_us));
+
+    KUNIT_EXPECT_EQ(test, run_commands(&rf, cmds, strlen(cmds), 0),
+                    (ssize_t)strlen(cmds));
+    KUNIT_EXPECT_STREQ(test, take_replies(test, &rf), "OK\n1000\nINVFMT\n");
+    KUNIT_EXPECT_EQ(test, session_quota_us(s), 1000);
+
+    /*Out of its quota, a move queues until the next period*/
+    s->period_start = ktime_get_ns();
+    s->period_used_ns = 1000 * NSEC_PER_USEC;
+    s->turn = s->bot;
+    mutex_lock(&s->mutex);
+    play_bot_move(s, 1000, &job);
+    mutex_unlock(&s->mutex);
+    KUNIT_EXPECT_GE(test, job.deadline, s->period_start +
+                    (u64)READ_ONCE(bot_period_ms) * NSEC_PER_MSEC);
+
+    kfree(rf.replies);
+}
+
+/*The AVX2 move generators agree with the scalar ones on random boards,
+  every square in play included*/
+static void reversi_test_simd_moves(struct kunit *test){
+#ifdef BB_SIMD
+    struct rnd_state rnd;
+    u64 P;
+    u64 O;
+    int i;
+
+    if (!static_branch_likely(&bb_simd_key)){
+        kunit_skip(test, "no AVX2");
+    }
+
+    prandom_seed_state(&rnd, 1037);
+    kernel_fpu_begin();
+    for (i = 0; i < 20000; i++){
+        P = (u64)prandom_u32_state(&rnd) << 32 | prandom_u32_state(&rnd);
+        O = (u64)prandom_u32_state(&rnd) << 32 | prandom_u32_state(&rnd);
+        P &= (u64)prandom_u32_state(&rnd) << 32 | prandom_u32_state(&rnd);
+        O &= ~P;
+        if (bb8_moves_simd(P, O) != bb8_moves(P, O) ||
+            bb6_moves_simd(P & bb6_full, O & bb6_full) !=
+            bb6_moves(P & bb6_full, O & bb6_full)){
+            break;
+        }
+    }
+    kernel_fpu_end();
+    KUNIT_EXPECT_EQ(test, i, 20000);
+#else
+    kunit_skip(test, "no AVX2 build");
+#endif
+}
+
+static bb128 size_moves(int size, bb128 P, bb128 O){
+    switch (size){
+    case 6:
+        return bb6_moves(P, O);
+    case 10:
+        return bb10_moves(P, O);
+    default:
+        return bb8_moves(P, O);
+    }
+}
+
+static bb128 size_flips(int size, bb128 P, bb128 O, int sq){
+    switch (size){
+    case 6:
+        return bb6_flips(P, O, sq);
+    case 10:
+        return bb10_flips(P, O, sq);
+    default:
+        return bb8_flips(P, O, sq);
+    }
+}
+
+/*Random games on every size, played on the text board with
+  check_adj_cells. Each size's bitboard moves and flips have to agree with
+  it at every position.*/
+static void reversi_test_geometries_match(struct kunit *test){
+    struct reversi_session *s;
+    struct reversi_file rf;
+    struct rnd_state rnd;
+    bb128 x_mask;
+    bb128 o_mask;
+    bb128 moves;
+    bb128 flips;
+    bb128 P;
+    bb128 O;
+    char piece;
+    char cmd[16];
+    int size;
+    int game;
+    int sq;
+    int n;
+
+    s = test_session(test, start_board, 'X');
+    rf.session = s;
+    prandom_seed_state(&rnd, 1032);
+
+    for (size = 6; size <= 10; size += 2){
+        for (game = 0; game < 20; game++){
+            snprintf(cmd, sizeof(cmd), "00 X %d\n", size);
+            run_command(&rf, cmd);
+            piece = 'X';
+
+            for (;;){
+                pack_board(s, &x_mask, &o_mask);
+                P = piece == 'X' ? x_mask : o_mask;
+                O = piece == 'X' ? o_mask : x_mask;
+
+                moves = 0;
+                for (sq = 0; sq < size * size; sq++){
+                    if (s->gameboard[sq / size][sq % size] == '-' &&
+                        check_adj_cells(s, sq / size, sq % size, piece, 1) == 1){
+                        moves |= (bb128)1 << sq;
+                    }
+                }
+                KUNIT_ASSERT_TRUE(test, size_moves(size, P, O) == moves);
+                KUNIT_EXPECT_EQ(test, check_for_valid_moves(s, piece),
+                                moves != 0);
+
+                if (moves == 0){
+                    if (check_game_end(s) == 1){
+                        break;
+                    }
+                    piece = piece == 'X' ? 'O' : 'X';
+                    continue;
+                }
+
+                for (n = prandom_u32_state(&rnd) % bb10_count(moves); n > 0; n--){
+                    moves &= moves - 1;
+                }
+                sq = bb10_first(moves);
+                flips = size_flips(size, P, O, sq);
+                KUNIT_ASSERT_EQ(test, check_adj_cells(s, sq / size, sq % size, piece, 0), 1);
+
+                pack_board(s, &x_mask, &o_mask);
+                KUNIT_EXPECT_TRUE(test, (piece == 'X' ? x_mask : o_mask) ==
+                                        (P | flips | ((bb128)1 << sq)));
+                KUNIT_EXPECT_TRUE(test, (piece == 'X' ? o_mask : x_mask) ==
+                                        (O & ~flips));
+                piece = piece == 'X' ? 'O' : 'X';
+            }
+        }
+    }
+}
+
+static struct kunit_case reversi_test_cases[] = {
+    KUNIT_CASE(reversi_test_start_move),
+    KUNIT_CASE(reversi_test_every_flank),
+    KUNIT_CASE(reversi_test_flip_runs_off_board),
+    KUNIT_CASE(reversi_test_multi_flip),
+    KUNIT_CASE(reversi_test_valid_moves_start),
+    KUNIT_CASE(reversi_test_pass),
+    KUNIT_CASE(reversi_test_game_end),
+    KUNIT_CASE(reversi_test_count_pieces),
+    KUNIT_CASE(reversi_test_bitboards_match),
+    KUNIT_CASE(reversi_test_board_sizes),
+    KUNIT_CASE(reversi_test_geometries_match),
+    KUNIT_CASE(reversi_test_batch),
+    KUNIT_CASE(reversi_test_self_play),
+    KUNIT_CASE(reversi_test_watch),
+    KUNIT_CASE(reversi_test_trace),
+    KUNIT_CASE(reversi_test_search_yield),
+    KUNIT_CASE(reversi_test_quota),
+    KUNIT_CASE(reversi_test_simd_moves),
+    KUNIT_CASE(reversi_test_endgame_cache),
+    KUNIT_CASE(reversi_test_numa),
+    {}
+};
+
+static struct kunit_suite reversi_test_suite = {
+    .name = "reversi",
+    .test_cases = reversi_test_cases,
+};
+
+/*Benchmarks. They report through kunit_info and only fail if the engine
+  misbehaves, run them on their own with kunit.py run 'reversi_bench'.*/
+#define BENCH_POSITIONS 256
+#define BENCH_ROUNDS    64
+
+/*Positions from the middle of random games, the same every run*/
+static void bench_positions(struct rnd_state *rnd, u64 *P, u64 *O){
+    int i;
+    int plies;
+
+    for (i = 0; i < BENCH_POSITIONS; i++){
+        P[i] = (1ULL << 28) | (1ULL << 35);
+        O[i] = (1ULL << 27) | (1ULL << 36);
+        plies = 10 + prandom_u32_state(rnd) % 40;
+        while (plies-- > 0 && random_move(rnd, &P[i], &O[i])){
+        }
+    }
+}
+
+/*check_adj_cells on every empty square, the way moves were found before
+  the bitboards*/
+static int scan_moves(struct reversi_session *s, char piece){
+    int i;
+    int j;
+
+    for (i = 0; i < s->size; i++){
+        for (j = 0; j < s->size; j++){
+            if (s->gameboard[i][j] == '-' &&
+                check_adj_cells(s, i, j, piece, 1) == 1){
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*Move generation, a check_adj_cells scan of the text board against
+  bb8_moves on bitboards*/
+static void reversi_bench_move_gen(struct kunit *test){
+    struct reversi_session **s;
+    struct rnd_state rnd;
+    u64 *P;
+    u64 *O;
+    u64 begin;
+    u64 scalar_ns;
+    u64 bb_ns;
+    u64 sink;
+    int round;
+    int i;
+
+    P = kunit_kcalloc(test, BENCH_POSITIONS, sizeof(u64), GFP_KERNEL);
+    O = kunit_kcalloc(test, BENCH_POSITIONS, sizeof(u64), GFP_KERNEL);
+    s = kunit_kcalloc(test, BENCH_POSITIONS, sizeof(*s), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, P);
+    KUNIT_ASSERT_NOT_NULL(test, O);
+    KUNIT_ASSERT_NOT_NULL(test, s);
+
+    prandom_seed_state(&rnd, 31);
+    bench_positions(&rnd, P, O);
+    for (i = 0; i < BENCH_POSITIONS; i++){
+        s[i] = test_session(test, start_board, 'X');
+        unpack_board(s[i], P[i], O[i]);
+    }
+
+    sink = 0;
+    begin = ktime_get_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++){
+        for (i = 0; i < BENCH_POSITIONS; i++){
+            sink += scan_moves(s[i], 'X');
+        }
+        cond_resched();
+    }
+    scalar_ns = ktime_get_ns() - begin;
+
+    begin = ktime_get_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++){
+        for (i = 0; i < BENCH_POSITIONS; i++){
+            sink += bb8_moves(P[i], O[i]) != 0;
+        }
+        cond_resched();
+    }
+    bb_ns = ktime_get_ns() - begin;
+
+    kunit_info(test, "check_adj_cells scan %llu ns/call, bb8_moves %llu ns/call (%llu)\n",
+               div_u64(scalar_ns, BENCH_ROUNDS * BENCH_POSITIONS),
+               div_u64(bb_ns, BENCH_ROUNDS * BENCH_POSITIONS), sink);
+
+#ifdef BB_SIMD
+    /*Holding the FPU for a whole round, as a search does*/
+    if (static_branch_likely(&bb_simd_key)){
+        u64 simd_ns;
+
+        begin = ktime_get_ns();
+        for (round = 0; round < BENCH_ROUNDS; round++){
+            kernel_fpu_begin();
+            for (i = 0; i < BENCH_POSITIONS; i++){
+                sink += bb8_moves_simd(P[i], O[i]) != 0;
+            }
+            kernel_fpu_end();
+            cond_resched();
+        }
+        simd_ns = ktime_get_ns() - begin;
+        kunit_info(test, "bb8_moves %llu ps/call, bb8_moves_simd %llu ps/call (%llu)\n",
+                   div_u64(bb_ns * 1000, BENCH_ROUNDS * BENCH_POSITIONS),
+                   div_u64(simd_ns * 1000, BENCH_ROUNDS * BENCH_POSITIONS), sink);
+    }
+#endif
+}
+
+/*Bot move latency through the search workers, for a few budgets*/
+static void reversi_bench_bot_move(struct kunit *test){
+    static const u32 budgets[] = { 1000, 5000, 20000 };
+    struct reversi_session *s;
+    struct search_job job;
+    struct rnd_state rnd;
+    u64 *P;
+    u64 *O;
+    u64 begin;
+    u64 total_ns;
+    u64 max_ns;
+    u64 nodes;
+    u64 ns;
+    int depth;
+    int b;
+    int i;
+
+    P = kunit_kcalloc(test, BENCH_POSITIONS, sizeof(u64), GFP_KERNEL);
+    O = kunit_kcalloc(test, BENCH_POSITIONS, sizeof(u64), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, P);
+    KUNIT_ASSERT_NOT_NULL(test, O);
+
+    s = test_session(test, start_board, 'X');
+    prandom_seed_state(&rnd, 77);
+    bench_positions(&rnd, P, O);
+
+    for (b = 0; b < ARRAY_SIZE(budgets); b++){
+        total_ns = 0;
+        max_ns = 0;
+        nodes = 0;
+        depth = 0;
+
+        for (i = 0; i < 16; i++){
+            unpack_board(s, P[i], O[i]);
+            s->turn = 'X';
+
+            begin = ktime_get_ns();
+            mutex_lock(&s->mutex);
+            run_bot_search(s, budgets[b], &job);
+            mutex_unlock(&s->mutex);
+            ns = ktime_get_ns() - begin;
+
+            if (job.row >= 0){
+                KUNIT_EXPECT_EQ(test, check_adj_cells(s, job.row, job.col, 'X', 1), 1);
+            }
+            total_ns += ns;
+            max_ns = max(max_ns, ns);
+            nodes += job.nodes;
+            depth += job.depth;
+        }
+
+        kunit_info(test, "budget %u us: mean %llu us, max %llu us, depth %d, %llu nodes/s\n",
+                   budgets[b], div_u64(total_ns, 16 * NSEC_PER_USEC),
+                   div_u64(max_ns, NSEC_PER_USEC), depth / 16,
+                   total_ns ? div64_u64(nodes * NSEC_PER_SEC, total_ns) : 0);
+    }
+}
+
+static struct kunit_case reversi_bench_cases[] = {
+    KUNIT_CASE(reversi_bench_move_gen),
+    KUNIT_CASE(reversi_bench_bot_move),
+    {}
+};
+
+static struct kunit_suite reversi_bench_suite = {
+    .name = "reversi_bench",
+    .test_cases = reversi_bench_cases,
+};
+
+kunit_test_suites(&reversi_test_suite, &reversi_bench_suite);